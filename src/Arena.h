@@ -0,0 +1,167 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ARENA_H_INCLUDED
+#define ARENA_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+/*
+    Memory for objects that are allocated in runs of consecutive slots
+    and freed all at once, like the nodes of a search tree. Objects are
+    referred to by a 32 bit index: the upper bits select a chunk in a
+    table shared by all arenas of the type, the lower bits the slot in
+    that chunk. Every thread carves its runs out of its own current
+    chunk, so only getting a new chunk takes a lock. Releasing an arena
+    frees its chunks without visiting the objects in them, so T must be
+    trivially destructible.
+*/
+template <typename T>
+class Arena {
+public:
+    static constexpr auto CHUNK_BITS = 14;
+    static constexpr auto CHUNK_SIZE = std::uint32_t{1} << CHUNK_BITS;
+    static constexpr auto MAX_CHUNKS = std::uint32_t{1} << (32 - CHUNK_BITS);
+    // Never returned by allocate.
+    static constexpr auto NONE = std::uint32_t{0};
+
+    Arena() = default;
+    ~Arena() {
+        release();
+    }
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // Returns the index of the first of count consecutive slots, in
+    // which the caller constructs the objects.
+    std::uint32_t allocate(const std::uint32_t count) {
+        assert(count > 0 && count <= CHUNK_SIZE);
+        auto& cursor = s_cursor;
+        if (cursor.arena_id != m_id || cursor.end - cursor.next < count) {
+            cursor.arena_id = m_id;
+            cursor.next = add_chunk();
+            cursor.end = cursor.next + CHUNK_SIZE;
+        }
+        const auto index = static_cast<std::uint32_t>(cursor.next);
+        cursor.next += count;
+        m_allocated.fetch_add(count, std::memory_order_relaxed);
+        return index;
+    }
+
+    static T* get(const std::uint32_t index) {
+        assert(index != NONE);
+        auto chunk = s_chunks[index >> CHUNK_BITS].get();
+        return reinterpret_cast<T*>(chunk) + (index & (CHUNK_SIZE - 1));
+    }
+
+    // Slots handed out since the last release.
+    size_t size() const {
+        return m_allocated.load(std::memory_order_relaxed);
+    }
+
+    // Frees all objects. Nobody may be allocating from the arena or
+    // using its objects, but other arenas can be in use.
+    void release() {
+        static_assert(std::is_trivially_destructible<T>::value,
+                      "Arena objects are freed without destruction");
+        auto storage = std::vector<std::unique_ptr<Storage[]>>{};
+        storage.reserve(m_chunks.size());
+        {
+            std::lock_guard<std::mutex> lock(s_mutex);
+            for (const auto chunk : m_chunks) {
+                storage.emplace_back(std::move(s_chunks[chunk]));
+                s_free_chunks.emplace_back(chunk);
+            }
+            // Outstanding thread cursors point into the freed chunks.
+            m_id = s_next_id++;
+        }
+        m_chunks.clear();
+        m_allocated = 0;
+        // Threads that need a chunk don't wait for the memory to be
+        // returned to the system.
+        storage.clear();
+    }
+
+private:
+    // Only instantiated when used, so that T can still be incomplete
+    // where the arena type is named.
+    struct Storage {
+        alignas(T) unsigned char bytes[sizeof(T)];
+    };
+
+    struct Cursor {
+        std::uint64_t arena_id;
+        std::uint64_t next;
+        std::uint64_t end;
+    };
+
+    std::uint32_t add_chunk() {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        auto chunk = std::uint32_t{0};
+        if (!s_free_chunks.empty()) {
+            chunk = s_free_chunks.back();
+            s_free_chunks.pop_back();
+        } else if (s_used_chunks < MAX_CHUNKS) {
+            chunk = s_used_chunks++;
+        } else {
+            throw std::bad_alloc();
+        }
+        // Not value initialized, the objects are constructed in place.
+        s_chunks[chunk].reset(new Storage[CHUNK_SIZE]);
+        m_chunks.emplace_back(chunk);
+        return chunk << CHUNK_BITS;
+    }
+
+    std::uint64_t m_id{s_next_id++};
+    std::atomic<size_t> m_allocated{0};
+    std::vector<std::uint32_t> m_chunks;
+
+    static std::unique_ptr<Storage[]> s_chunks[MAX_CHUNKS];
+    static std::vector<std::uint32_t> s_free_chunks;
+    // Chunk 0 is never used, so that index 0 can be NONE.
+    static std::uint32_t s_used_chunks;
+    static std::mutex s_mutex;
+    static std::atomic<std::uint64_t> s_next_id;
+    static thread_local Cursor s_cursor;
+};
+
+template <typename T>
+std::unique_ptr<typename Arena<T>::Storage[]>
+    Arena<T>::s_chunks[Arena<T>::MAX_CHUNKS];
+template <typename T>
+std::vector<std::uint32_t> Arena<T>::s_free_chunks;
+template <typename T>
+std::uint32_t Arena<T>::s_used_chunks{1};
+template <typename T>
+std::mutex Arena<T>::s_mutex;
+template <typename T>
+std::atomic<std::uint64_t> Arena<T>::s_next_id{1};
+template <typename T>
+thread_local typename Arena<T>::Cursor Arena<T>::s_cursor{0, 0, 0};
+
+#endif
@@ -0,0 +1,640 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "CPUPipe.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <string>
+#include <vector>
+
+#ifdef __APPLE__
+#include <Accelerate/Accelerate.h>
+#endif
+#ifdef USE_MKL
+#include <mkl.h>
+#endif
+#ifdef USE_OPENBLAS
+#include <cblas.h>
+#endif
+
+#include "GTP.h"
+#include "Network.h"
+#include "Timing.h"
+#include "Utils.h"
+
+constexpr auto WINOGRAD_ALPHA = Network::WINOGRAD_ALPHA;
+constexpr auto WINOGRAD_TILE = Network::WINOGRAD_TILE;
+constexpr auto WINOGRAD_WTILES = (19 + 1) / 2;
+constexpr auto WINOGRAD_P = WINOGRAD_WTILES * WINOGRAD_WTILES;
+constexpr auto BOARD_SQUARES = 19 * 19;
+constexpr auto CH_BLOCK = CPUPipe::CHANNEL_BLOCK;
+
+static int pad_channels(const int channels) {
+    return int(Utils::ceilMultiple(channels, CH_BLOCK));
+}
+
+void CPUPipe::initialize(const int channels) {
+    m_tile_block = tune_tile_block(channels);
+
+    const auto entry_size =
+        size_t{BOARD_SQUARES} * pad_channels(channels) * sizeof(float);
+    m_input_cache_size = size_t(cfg_input_cache_mb) * 1024 * 1024
+                         / entry_size;
+}
+
+std::string CPUPipe::get_name() const {
+    return "CPU (BLAS)";
+}
+
+void CPUPipe::to_blocked(const std::vector<float>& in,
+                         std::vector<float>& out,
+                         const int C) {
+    std::fill(begin(out), end(out), 0.0f);
+    for (auto c = 0; c < C; c++) {
+        const auto cb = c / CH_BLOCK;
+        const auto l = c % CH_BLOCK;
+        for (auto s = 0; s < BOARD_SQUARES; s++) {
+            out[(cb * BOARD_SQUARES + s) * CH_BLOCK + l] =
+                in[c * BOARD_SQUARES + s];
+        }
+    }
+}
+
+void CPUPipe::winograd_transform_in(const std::vector<float>& in,
+                                    std::vector<float>& V,
+                                    const int C,
+                                    const int first_tile, const int tiles) {
+    constexpr auto W = 19;
+    constexpr auto H = 19;
+    constexpr auto wtiles = WINOGRAD_WTILES;
+
+    using WinogradTile =
+        std::array<std::array<std::array<float, CH_BLOCK>,
+                              WINOGRAD_ALPHA>, WINOGRAD_ALPHA>;
+
+    for (auto cb = 0; cb < C / CH_BLOCK; cb++) {
+        for (auto t = 0; t < tiles; t++) {
+            const auto block_y = (first_tile + t) / wtiles;
+            const auto block_x = (first_tile + t) % wtiles;
+
+            // Tiles overlap by 2
+            const auto yin = 2 * block_y - 1;
+            const auto xin = 2 * block_x - 1;
+
+            // Cache input tile and handle zero padding
+            WinogradTile x;
+            for (auto i = 0; i < WINOGRAD_ALPHA; i++) {
+                for (auto j = 0; j < WINOGRAD_ALPHA; j++) {
+                    if ((yin + i) >= 0 && (xin + j) >= 0
+                        && (yin + i) < H && (xin + j) < W) {
+                        const auto src = &in[(cb * (W*H)
+                                              + (yin+i)*W + (xin+j))
+                                             * CH_BLOCK];
+                        std::copy(src, src + CH_BLOCK, begin(x[i][j]));
+                    } else {
+                        x[i][j].fill(0.0f);
+                    }
+                }
+            }
+
+            // Calculates transpose(B).x.B
+            // B = [[ 1.0,  0.0,  0.0,  0.0],
+            //      [ 0.0,  1.0, -1.0,  1.0],
+            //      [-1.0,  1.0,  1.0,  0.0],
+            //      [ 0.0,  0.0,  0.0, -1.0]]
+
+            WinogradTile T1;
+            for (auto j = 0; j < WINOGRAD_ALPHA; j++) {
+                for (auto l = 0; l < CH_BLOCK; l++) {
+                    T1[0][j][l] = x[0][j][l] - x[2][j][l];
+                    T1[1][j][l] = x[1][j][l] + x[2][j][l];
+                    T1[2][j][l] = x[2][j][l] - x[1][j][l];
+                    T1[3][j][l] = x[1][j][l] - x[3][j][l];
+                }
+            }
+
+            // V is [16][tiles][C], the channels of a tile are contiguous
+            const auto offset = t * C + cb * CH_BLOCK;
+            const auto stride = tiles * C;
+            for (auto i = 0; i < WINOGRAD_ALPHA; i++) {
+                auto v = &V[i * WINOGRAD_ALPHA * stride + offset];
+                for (auto l = 0; l < CH_BLOCK; l++) {
+                    v[0 * stride + l] = T1[i][0][l] - T1[i][2][l];
+                    v[1 * stride + l] = T1[i][1][l] + T1[i][2][l];
+                    v[2 * stride + l] = T1[i][2][l] - T1[i][1][l];
+                    v[3 * stride + l] = T1[i][1][l] - T1[i][3][l];
+                }
+            }
+        }
+    }
+}
+
+void CPUPipe::winograd_sgemm(const std::vector<float>& U,
+                             std::vector<float>& V,
+                             std::vector<float>& M,
+                             const int C, const int K, const int P) {
+    for (auto b = 0; b < WINOGRAD_TILE; b++) {
+        auto offset_u = b * C * K;
+        auto offset_v = b * P * C;
+        auto offset_m = b * P * K;
+
+        // M[P][K] = V[P][C] x U[C][K]
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
+                    P, K, C,
+                    1.0f,
+                    &V[offset_v], C,
+                    &U[offset_u], K,
+                    0.0f,
+                    &M[offset_m], K);
+    }
+}
+
+void CPUPipe::winograd_transform_out(const std::vector<float>& M,
+                                     std::vector<float>& Y,
+                                     const int K,
+                                     const int first_tile, const int tiles,
+                                     const float* const means,
+                                     const float* const stddivs,
+                                     const float* const eltwise) {
+    constexpr auto W = 19;
+    constexpr auto H = 19;
+    constexpr auto wtiles = WINOGRAD_WTILES;
+    const auto stride = tiles * K;
+
+    for (auto kb = 0; kb < K / CH_BLOCK; kb++) {
+        const auto mean = &means[kb * CH_BLOCK];
+        const auto stddiv = &stddivs[kb * CH_BLOCK];
+        for (auto b = 0; b < tiles; b++) {
+            const auto x = 2 * ((first_tile + b) % wtiles);
+            const auto y = 2 * ((first_tile + b) / wtiles);
+
+            // Calculates transpose(A).m.A
+            //    A = [1.0,  0.0],
+            //        [1.0,  1.0],
+            //        [1.0, -1.0],
+            //        [0.0, -1.0]]
+            const auto m = &M[b * K + kb * CH_BLOCK];
+            std::array<std::array<float, CH_BLOCK>, 2 * WINOGRAD_ALPHA> T1;
+            for (auto nu = 0; nu < WINOGRAD_ALPHA; nu++) {
+                for (auto l = 0; l < CH_BLOCK; l++) {
+                    const auto m0 = m[(0 * WINOGRAD_ALPHA + nu) * stride + l];
+                    const auto m1 = m[(1 * WINOGRAD_ALPHA + nu) * stride + l];
+                    const auto m2 = m[(2 * WINOGRAD_ALPHA + nu) * stride + l];
+                    const auto m3 = m[(3 * WINOGRAD_ALPHA + nu) * stride + l];
+                    T1[nu][l] = m0 + m1 + m2;
+                    T1[WINOGRAD_ALPHA + nu][l] = m1 - m2 - m3;
+                }
+            }
+
+            std::array<std::array<float, CH_BLOCK>, 4> o;
+            for (auto l = 0; l < CH_BLOCK; l++) {
+                o[0][l] = T1[0][l] + T1[1][l] + T1[2][l];
+                o[1][l] = T1[1][l] - T1[2][l] - T1[3][l];
+                o[2][l] = T1[4][l] + T1[5][l] + T1[6][l];
+                o[3][l] = T1[5][l] - T1[6][l] - T1[7][l];
+            }
+
+            // Batchnorm, optional residual add and ReLU on the way out
+            const int out_y[4] = {y, y, y + 1, y + 1};
+            const int out_x[4] = {x, x + 1, x, x + 1};
+            for (auto i = 0; i < 4; i++) {
+                if (out_y[i] >= H || out_x[i] >= W) {
+                    continue;
+                }
+                const auto idx = (kb * (W*H) + out_y[i] * W + out_x[i])
+                                 * CH_BLOCK;
+                auto out = &Y[idx];
+                if (eltwise == nullptr) {
+                    for (auto l = 0; l < CH_BLOCK; l++) {
+                        const auto val = stddiv[l] * (o[i][l] - mean[l]);
+                        out[l] = val > 0.0f ? val : 0.0f;
+                    }
+                } else {
+                    auto res = &eltwise[idx];
+                    for (auto l = 0; l < CH_BLOCK; l++) {
+                        const auto val = res[l]
+                                         + stddiv[l] * (o[i][l] - mean[l]);
+                        out[l] = val > 0.0f ? val : 0.0f;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void CPUPipe::winograd_convolve3(const int channels, const int outputs,
+                                 const std::vector<float>& input,
+                                 const std::vector<float>& U,
+                                 std::vector<float>& V,
+                                 std::vector<float>& M,
+                                 std::vector<float>& output,
+                                 const int tile_block,
+                                 const float* const means,
+                                 const float* const stddivs,
+                                 const float* const eltwise) {
+    // Run the transforms and the multiplication block by block, so the
+    // intermediate results don't leave the cache between the phases.
+    for (auto first = 0; first < WINOGRAD_P; first += tile_block) {
+        const auto tiles = std::min(tile_block, WINOGRAD_P - first);
+        winograd_transform_in(input, V, channels, first, tiles);
+        winograd_sgemm(U, V, M, channels, outputs, tiles);
+        winograd_transform_out(M, output, outputs, first, tiles,
+                               means, stddivs, eltwise);
+    }
+}
+
+void CPUPipe::convolve1(const int channels, const int outputs,
+                        const std::vector<float>& input,
+                        const std::vector<float>& weights,
+                        std::vector<float>& output) {
+    // Weight shape (output, input, 1, 1), the input is channel blocked
+    // and the output is back in plain layout for the heads.
+    // Biases were folded into the batchnorm means of the heads.
+    std::fill(begin(output), end(output), 0.0f);
+    for (auto o = 0; o < outputs; o++) {
+        auto out = &output[o * BOARD_SQUARES];
+        for (auto cb = 0; cb < pad_channels(channels) / CH_BLOCK; cb++) {
+            std::array<float, CH_BLOCK> w;
+            for (auto l = 0; l < CH_BLOCK; l++) {
+                const auto c = cb * CH_BLOCK + l;
+                w[l] = c < channels ? weights[o * channels + c] : 0.0f;
+            }
+            auto in = &input[cb * BOARD_SQUARES * CH_BLOCK];
+            for (auto s = 0; s < BOARD_SQUARES; s++) {
+                auto acc = 0.0f;
+                for (auto l = 0; l < CH_BLOCK; l++) {
+                    acc += w[l] * in[s * CH_BLOCK + l];
+                }
+                out[s] += acc;
+            }
+        }
+    }
+}
+
+void CPUPipe::batchnorm_relu(const std::vector<float>& means,
+                             const std::vector<float>& stddivs,
+                             std::vector<float>& data) {
+    for (auto c = size_t{0}; c < means.size(); c++) {
+        const auto mean = means[c];
+        const auto scale_stddiv = stddivs[c];
+        auto arr = &data[c * BOARD_SQUARES];
+        for (auto b = 0; b < BOARD_SQUARES; b++) {
+            const auto val = scale_stddiv * (arr[b] - mean);
+            arr[b] = val > 0.0f ? val : 0.0f;
+        }
+    }
+}
+
+void CPUPipe::innerproduct(const std::vector<float>& weights,
+                           const std::vector<float>& biases,
+                           const std::vector<float>& input,
+                           std::vector<float>& output) {
+    // Weight shape (output, input), no activation
+    const auto outputs = int(biases.size());
+    const auto inputs = int(input.size());
+    std::copy(begin(biases), end(biases), begin(output));
+    cblas_sgemv(CblasRowMajor, CblasNoTrans,
+                // M     K
+                outputs, inputs,
+                1.0f, &weights[0], inputs,
+                &input[0], 1,
+                1.0f, &output[0], 1);
+}
+
+int CPUPipe::tune_tile_block(const int channels) {
+    // Whether splitting the convolution in blocks of tiles pays off
+    // depends on the cache sizes and on how well the BLAS copes with
+    // narrow matrices, so time a residual layer for a few block sizes.
+    // Block sizes are whole tile rows.
+    const auto C = pad_channels(channels);
+    const auto U = std::vector<float>(WINOGRAD_TILE * C * C, 0.1f);
+    const auto input = std::vector<float>(C * BOARD_SQUARES, 1.0f);
+    const auto means = std::vector<float>(C, 0.0f);
+    const auto stddivs = std::vector<float>(C, 1.0f);
+    auto output = std::vector<float>(C * BOARD_SQUARES);
+    auto V = std::vector<float>(WINOGRAD_TILE * C * WINOGRAD_P);
+    auto M = std::vector<float>(WINOGRAD_TILE * C * WINOGRAD_P);
+
+    auto best_block = WINOGRAD_P;
+    auto best_time = 0.0;
+    for (const auto rows : {WINOGRAD_WTILES, 5, 2, 1}) {
+        const auto tile_block = rows * WINOGRAD_WTILES;
+        auto time = 0.0;
+        for (auto rep = 0; rep < 3; rep++) {
+            Time start;
+            winograd_convolve3(C, C, input, U, V, M, output, tile_block,
+                               means.data(), stddivs.data(), nullptr);
+            Time end;
+            const auto elapsed = Time::timediff_seconds(start, end);
+            time = (rep == 0) ? elapsed : std::min(time, elapsed);
+        }
+        if (tile_block == WINOGRAD_P || time < best_time) {
+            best_block = tile_block;
+            best_time = time;
+        }
+    }
+    if (best_block != WINOGRAD_P) {
+        Utils::myprintf("CPU convolutions in blocks of %d tiles.\n",
+                        best_block);
+    }
+    return best_block;
+}
+
+// Slot h < INPUT_MOVES covers the stones of the board h moves ago,
+// the last slot covers the side to move planes.
+static std::array<int, 2> slot_planes(const int slot) {
+    if (slot < Network::INPUT_MOVES) {
+        return {slot, Network::INPUT_MOVES + slot};
+    }
+    return {2 * Network::INPUT_MOVES, 2 * Network::INPUT_MOVES + 1};
+}
+
+CPUPipe::InputPartial CPUPipe::get_input_partial(
+    const std::vector<float>& input, const int slot) {
+
+    const auto planes = slot_planes(slot);
+
+    // Planes are binary, so the key is a hash of their bits
+    auto hash = std::uint64_t{0x9E3779B97F4A7C15} * (slot + 1);
+    for (const auto plane : planes) {
+        auto word = std::uint64_t{0};
+        for (auto s = 0; s < BOARD_SQUARES; s++) {
+            assert(input[plane * BOARD_SQUARES + s] == 0.0f
+                   || input[plane * BOARD_SQUARES + s] == 1.0f);
+            word = (word << 1) | (input[plane * BOARD_SQUARES + s] != 0.0f);
+            if (s % 64 == 63 || s == BOARD_SQUARES - 1) {
+                hash = (hash ^ word) * std::uint64_t{0xFF51AFD7ED558CCD};
+                hash ^= hash >> 32;
+                word = 0;
+            }
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_input_cache_mutex);
+        auto iter = m_input_cache.find(hash);
+        if (iter != m_input_cache.end()) {
+            return iter->second;
+        }
+    }
+
+    // Scatter the filters of every stone. The convolution is linear,
+    // so the contributions of the slots add up to the full result.
+    const auto outputs = m_layers[0].outputs;
+    auto partial = std::make_shared<std::vector<float>>(
+        BOARD_SQUARES * outputs);
+    for (const auto plane : planes) {
+        for (auto s = 0; s < BOARD_SQUARES; s++) {
+            const auto val = input[plane * BOARD_SQUARES + s];
+            if (val == 0.0f) {
+                continue;
+            }
+            const auto y = s / 19;
+            const auto x = s % 19;
+            for (auto fy = 0; fy < 3; fy++) {
+                const auto out_y = y - fy + 1;
+                if (out_y < 0 || out_y >= 19) continue;
+                for (auto fx = 0; fx < 3; fx++) {
+                    const auto out_x = x - fx + 1;
+                    if (out_x < 0 || out_x >= 19) continue;
+                    const auto w = &m_input_weights[(plane * 9 + fy * 3 + fx)
+                                                    * outputs];
+                    auto out = &(*partial)[(out_y * 19 + out_x) * outputs];
+                    for (auto k = 0; k < outputs; k++) {
+                        out[k] += val * w[k];
+                    }
+                }
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_input_cache_mutex);
+    if (m_input_cache.emplace(hash, partial).second) {
+        m_input_cache_order.push_back(hash);
+        // If the cache is too large, remove the oldest entry.
+        if (m_input_cache_order.size() > m_input_cache_size) {
+            m_input_cache.erase(m_input_cache_order.front());
+            m_input_cache_order.pop_front();
+        }
+    }
+    return partial;
+}
+
+void CPUPipe::forward_input_cached(const std::vector<float>& input,
+                                   std::vector<float>& output) {
+    // A position shares all but one of its history boards with its
+    // siblings, so most contributions come from the cache and only
+    // batchnorm and ReLU need recomputing.
+    const auto& layer = m_layers[0];
+    const auto outputs = layer.outputs;
+    auto sum = std::vector<float>(BOARD_SQUARES * outputs);
+    for (auto slot = 0; slot <= Network::INPUT_MOVES; slot++) {
+        const auto partial = get_input_partial(input, slot);
+        for (auto i = size_t{0}; i < sum.size(); i++) {
+            sum[i] += (*partial)[i];
+        }
+    }
+
+    for (auto kb = 0; kb < outputs / CH_BLOCK; kb++) {
+        for (auto s = 0; s < BOARD_SQUARES; s++) {
+            auto in = &sum[s * outputs + kb * CH_BLOCK];
+            auto out = &output[(kb * BOARD_SQUARES + s) * CH_BLOCK];
+            for (auto l = 0; l < CH_BLOCK; l++) {
+                const auto k = kb * CH_BLOCK + l;
+                const auto val = layer.stddivs[k] * (in[l] - layer.means[k]);
+                out[l] = val > 0.0f ? val : 0.0f;
+            }
+        }
+    }
+}
+
+void CPUPipe::forward(const std::vector<float>& input,
+                      std::vector<float>& output_pol,
+                      std::vector<float>& output_val) {
+    // Channel counts, padded to whole channel blocks
+    const auto input_channels = m_layers[0].channels;
+    const auto channels = m_layers[0].outputs;
+    const auto max_channels = std::max(input_channels, channels);
+
+    auto V = std::vector<float>(WINOGRAD_TILE * max_channels * m_tile_block);
+    auto M = std::vector<float>(WINOGRAD_TILE * channels * m_tile_block);
+
+    auto conv_out = std::vector<float>(channels * BOARD_SQUARES);
+    auto conv_mid = std::vector<float>(channels * BOARD_SQUARES);
+    auto conv_next = std::vector<float>(channels * BOARD_SQUARES);
+
+    // Input convolution
+    if (m_input_cache_size > 0) {
+        forward_input_cached(input, conv_out);
+    } else {
+        // Activations stay channel blocked through the whole tower
+        auto blocked_input =
+            std::vector<float>(input_channels * BOARD_SQUARES);
+        to_blocked(input, blocked_input, Network::INPUT_CHANNELS);
+
+        const auto& input_layer = m_layers[0];
+        winograd_convolve3(input_layer.channels, input_layer.outputs,
+                           blocked_input, input_layer.weights, V, M, conv_out,
+                           m_tile_block,
+                           input_layer.means.data(),
+                           input_layer.stddivs.data(),
+                           nullptr);
+    }
+
+    // Residual tower
+    for (auto i = size_t{1}; i < m_layers.size(); i += 2) {
+        const auto& layer1 = m_layers[i];
+        const auto& layer2 = m_layers[i + 1];
+        winograd_convolve3(layer1.channels, layer1.outputs, conv_out,
+                           layer1.weights, V, M, conv_mid, m_tile_block,
+                           layer1.means.data(), layer1.stddivs.data(),
+                           nullptr);
+        winograd_convolve3(layer2.channels, layer2.outputs, conv_mid,
+                           layer2.weights, V, M, conv_next, m_tile_block,
+                           layer2.means.data(), layer2.stddivs.data(),
+                           conv_out.data());
+        std::swap(conv_out, conv_next);
+    }
+
+    auto policy_data =
+        std::vector<float>(Network::OUTPUTS_POLICY * BOARD_SQUARES);
+    auto value_data =
+        std::vector<float>(Network::OUTPUTS_VALUE * BOARD_SQUARES);
+    convolve1(m_head_channels, Network::OUTPUTS_POLICY,
+              conv_out, m_conv_pol_w, policy_data);
+    convolve1(m_head_channels, Network::OUTPUTS_VALUE,
+              conv_out, m_conv_val_w, value_data);
+
+    // Policy logits
+    batchnorm_relu(m_bn_pol_means, m_bn_pol_stddivs, policy_data);
+    innerproduct(m_ip_pol_w, m_ip_pol_b, policy_data, output_pol);
+
+    // Value: hidden layer, then ReLU and the final inner product
+    batchnorm_relu(m_bn_val_means, m_bn_val_stddivs, value_data);
+    auto hidden = std::vector<float>(Network::VALUE_HIDDEN);
+    innerproduct(m_ip1_val_w, m_ip1_val_b, value_data, hidden);
+    auto value = m_ip2_val_b[0];
+    for (auto i = 0; i < Network::VALUE_HIDDEN; i++) {
+        const auto val = hidden[i] > 0.0f ? hidden[i] : 0.0f;
+        value += m_ip2_val_w[i] * val;
+    }
+    output_val[0] = value;
+}
+
+void CPUPipe::push_weights(unsigned int channels, unsigned int outputs,
+                           const std::vector<float>& weights,
+                           const std::vector<float>& means,
+                           const std::vector<float>& variances) {
+    // Pad to whole channel blocks. Padding channels get zero weights
+    // and a zero scale, so they stay zero through the tower.
+    const auto channels_pad = pad_channels(channels);
+    const auto outputs_pad = pad_channels(outputs);
+
+    auto layer = ConvLayer{};
+    layer.channels = channels_pad;
+    layer.outputs = outputs_pad;
+    layer.weights = Network::zeropad_U(
+        Network::winograd_transform_f(weights, outputs, channels),
+        outputs, channels, outputs_pad, channels_pad);
+    layer.means = means;
+    layer.means.resize(outputs_pad, 0.0f);
+    layer.stddivs = variances;
+    layer.stddivs.resize(outputs_pad, 0.0f);
+    m_layers.emplace_back(std::move(layer));
+}
+
+void CPUPipe::push_input_convolution(unsigned int filter_size,
+                                     unsigned int channels,
+                                     unsigned int outputs,
+                                     const std::vector<float>& weights,
+                                     const std::vector<float>& means,
+                                     const std::vector<float>& variances) {
+    assert(filter_size == 3);
+    (void)filter_size;
+    push_weights(channels, outputs, weights, means, variances);
+
+    // Keep the plain filters around for the cached input convolution
+    const auto outputs_pad = pad_channels(outputs);
+    m_input_weights.assign(channels * 9 * outputs_pad, 0.0f);
+    for (auto o = size_t{0}; o < outputs; o++) {
+        for (auto c = size_t{0}; c < channels; c++) {
+            for (auto f = 0; f < 9; f++) {
+                m_input_weights[(c * 9 + f) * outputs_pad + o] =
+                    weights[(o * channels + c) * 9 + f];
+            }
+        }
+    }
+}
+
+void CPUPipe::push_residual(unsigned int filter_size,
+                            unsigned int channels,
+                            unsigned int outputs,
+                            const std::vector<float>& weights_1,
+                            const std::vector<float>& means_1,
+                            const std::vector<float>& variances_1,
+                            const std::vector<float>& weights_2,
+                            const std::vector<float>& means_2,
+                            const std::vector<float>& variances_2) {
+    assert(filter_size == 3);
+    (void)filter_size;
+    push_weights(channels, outputs, weights_1, means_1, variances_1);
+    push_weights(outputs, outputs, weights_2, means_2, variances_2);
+}
+
+void CPUPipe::push_convolve1(unsigned int channels,
+                             unsigned int outputs,
+                             const std::vector<float>& weights) {
+    assert(weights.size() == channels * outputs);
+    m_head_channels = channels;
+    if (outputs == Network::OUTPUTS_POLICY) {
+        m_conv_pol_w = weights;
+    } else {
+        assert(outputs == Network::OUTPUTS_VALUE);
+        m_conv_val_w = weights;
+    }
+}
+
+void CPUPipe::push_policy_head(const std::vector<float>& means,
+                               const std::vector<float>& stddivs,
+                               const std::vector<float>& ip_w,
+                               const std::vector<float>& ip_b) {
+    assert(ip_w.size() == ip_b.size() * means.size() * BOARD_SQUARES);
+    m_bn_pol_means = means;
+    m_bn_pol_stddivs = stddivs;
+    m_ip_pol_w = ip_w;
+    m_ip_pol_b = ip_b;
+}
+
+void CPUPipe::push_value_head(const std::vector<float>& means,
+                              const std::vector<float>& stddivs,
+                              const std::vector<float>& ip1_w,
+                              const std::vector<float>& ip1_b,
+                              const std::vector<float>& ip2_w,
+                              const std::vector<float>& ip2_b) {
+    assert(ip1_w.size() == ip1_b.size() * means.size() * BOARD_SQUARES);
+    assert(ip2_w.size() == ip1_b.size() && ip2_b.size() == 1);
+    m_bn_val_means = means;
+    m_bn_val_stddivs = stddivs;
+    m_ip1_val_w = ip1_w;
+    m_ip1_val_b = ip1_b;
+    m_ip2_val_w = ip2_w;
+    m_ip2_val_b = ip2_b;
+}
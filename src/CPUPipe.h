@@ -0,0 +1,185 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CPUPIPE_H_INCLUDED
+#define CPUPIPE_H_INCLUDED
+
+#include "config.h"
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ForwardPipe.h"
+
+/*
+    Winograd convolutions on the CPU, with the multiplications done
+    by BLAS. Activations are kept in a channel blocked layout:
+    [channels / CHANNEL_BLOCK][19 * 19][CHANNEL_BLOCK], so that the
+    transforms and batchnorm work on contiguous groups of channels.
+    Channel counts are padded up to whole blocks.
+
+    Optionally, the input convolution is assembled from cached per
+    history board contributions, see forward_input_cached.
+*/
+class CPUPipe : public ForwardPipe {
+public:
+    static constexpr auto CHANNEL_BLOCK = 8;
+
+    virtual void initialize(const int channels);
+    virtual std::string get_name() const;
+
+    virtual void push_input_convolution(unsigned int filter_size,
+                                        unsigned int channels,
+                                        unsigned int outputs,
+                                        const std::vector<float>& weights,
+                                        const std::vector<float>& means,
+                                        const std::vector<float>& variances);
+
+    virtual void push_residual(unsigned int filter_size,
+                               unsigned int channels,
+                               unsigned int outputs,
+                               const std::vector<float>& weights_1,
+                               const std::vector<float>& means_1,
+                               const std::vector<float>& variances_1,
+                               const std::vector<float>& weights_2,
+                               const std::vector<float>& means_2,
+                               const std::vector<float>& variances_2);
+
+    virtual void push_convolve1(unsigned int channels,
+                                unsigned int outputs,
+                                const std::vector<float>& weights);
+
+    virtual void push_policy_head(const std::vector<float>& means,
+                                  const std::vector<float>& stddivs,
+                                  const std::vector<float>& ip_w,
+                                  const std::vector<float>& ip_b);
+
+    virtual void push_value_head(const std::vector<float>& means,
+                                 const std::vector<float>& stddivs,
+                                 const std::vector<float>& ip1_w,
+                                 const std::vector<float>& ip1_b,
+                                 const std::vector<float>& ip2_w,
+                                 const std::vector<float>& ip2_b);
+
+    virtual void forward(const std::vector<float>& input,
+                         std::vector<float>& output_pol,
+                         std::vector<float>& output_val);
+
+private:
+    struct ConvLayer {
+        int channels;
+        int outputs;
+        // Winograd transformed, [16][channels][outputs]
+        std::vector<float> weights;
+        std::vector<float> means;
+        std::vector<float> stddivs;
+    };
+
+    static int tune_tile_block(const int channels);
+    static void to_blocked(const std::vector<float>& in,
+                           std::vector<float>& out,
+                           const int C);
+    static void winograd_transform_in(const std::vector<float>& in,
+                                      std::vector<float>& V,
+                                      const int C,
+                                      const int first_tile, const int tiles);
+    static void winograd_transform_out(const std::vector<float>& M,
+                                       std::vector<float>& Y,
+                                       const int K,
+                                       const int first_tile, const int tiles,
+                                       const float* const means,
+                                       const float* const stddivs,
+                                       const float* const eltwise);
+    static void winograd_convolve3(const int channels, const int outputs,
+                                   const std::vector<float>& input,
+                                   const std::vector<float>& U,
+                                   std::vector<float>& V,
+                                   std::vector<float>& M,
+                                   std::vector<float>& output,
+                                   const int tile_block,
+                                   const float* const means,
+                                   const float* const stddivs,
+                                   const float* const eltwise);
+    static void winograd_sgemm(const std::vector<float>& U,
+                               std::vector<float>& V,
+                               std::vector<float>& M,
+                               const int C, const int K, const int P);
+    static void convolve1(const int channels, const int outputs,
+                          const std::vector<float>& input,
+                          const std::vector<float>& weights,
+                          std::vector<float>& output);
+    static void batchnorm_relu(const std::vector<float>& means,
+                               const std::vector<float>& stddivs,
+                               std::vector<float>& data);
+    static void innerproduct(const std::vector<float>& weights,
+                             const std::vector<float>& biases,
+                             const std::vector<float>& input,
+                             std::vector<float>& output);
+
+    using InputPartial = std::shared_ptr<const std::vector<float>>;
+    void forward_input_cached(const std::vector<float>& input,
+                              std::vector<float>& output);
+    InputPartial get_input_partial(const std::vector<float>& input,
+                                   const int slot);
+
+    void push_weights(unsigned int channels, unsigned int outputs,
+                      const std::vector<float>& weights,
+                      const std::vector<float>& means,
+                      const std::vector<float>& variances);
+
+    // Amount of Winograd tiles transformed and multiplied together
+    int m_tile_block{0};
+
+    // Input + residual block tower
+    std::vector<ConvLayer> m_layers;
+
+    // Input convolution weights, not transformed, [planes][3x3][outputs]
+    std::vector<float> m_input_weights;
+
+    // Cache of input convolution contributions, keyed by a hash of
+    // the planes of one history board. Entries are [19x19][outputs].
+    size_t m_input_cache_size{0};
+    std::mutex m_input_cache_mutex;
+    std::unordered_map<std::uint64_t, InputPartial> m_input_cache;
+    // Order entries were added to the map.
+    std::deque<std::uint64_t> m_input_cache_order;
+
+    // 1x1 convolutions of the policy and value heads
+    int m_head_channels{0};
+    std::vector<float> m_conv_pol_w;
+    std::vector<float> m_conv_val_w;
+
+    // Fully connected heads
+    std::vector<float> m_bn_pol_means;
+    std::vector<float> m_bn_pol_stddivs;
+    std::vector<float> m_ip_pol_w;
+    std::vector<float> m_ip_pol_b;
+    std::vector<float> m_bn_val_means;
+    std::vector<float> m_bn_val_stddivs;
+    std::vector<float> m_ip1_val_w;
+    std::vector<float> m_ip1_val_b;
+    std::vector<float> m_ip2_val_w;
+    std::vector<float> m_ip2_val_b;
+};
+
+#endif
@@ -0,0 +1,52 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "ForwardPipe.h"
+
+#include <cassert>
+#include <cstdint>
+#include <future>
+#include <vector>
+
+#include "Network.h"
+
+void ForwardPipe::forward_packed(const size_t batch_size,
+                                 const std::vector<std::uint32_t>& input,
+                                 std::vector<float>& output_pol,
+                                 std::vector<float>& output_val) {
+    constexpr auto input_size = Network::INPUT_CHANNELS * 19 * 19;
+    assert(input.size() == batch_size * Network::PACKED_INPUT_SIZE);
+    auto unpacked = std::vector<float>(batch_size * input_size);
+    for (auto i = size_t{0}; i < batch_size; i++) {
+        Network::unpack_input(input.data() + i * Network::PACKED_INPUT_SIZE,
+                              unpacked.data() + i * input_size);
+    }
+    forward_batch(batch_size, unpacked, output_pol, output_val);
+}
+
+std::future<void> ForwardPipe::forward_packed_async(
+    const size_t batch_size,
+    const std::vector<std::uint32_t>& input,
+    std::vector<float>& output_pol,
+    std::vector<float>& output_val) {
+    forward_packed(batch_size, input, output_pol, output_val);
+    auto done = std::promise<void>{};
+    done.set_value();
+    return done.get_future();
+}
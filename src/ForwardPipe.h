@@ -0,0 +1,145 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FORWARDPIPE_H_INCLUDED
+#define FORWARDPIPE_H_INCLUDED
+
+#include "config.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <string>
+#include <vector>
+
+/*
+    Interface of an inference backend. A backend receives the weights
+    of the residual tower and of the policy and value heads, and computes
+    the policy logits (one per move, pass last) and the value head output
+    before the final tanh.
+
+    Weights are pushed in network order. Convolution weights are the raw
+    3x3 filters as read from the weights file, so that every backend can
+    apply its own transformation and padding.
+*/
+class ForwardPipe {
+public:
+    enum class Precision {
+        SINGLE, HALF
+    };
+
+    virtual ~ForwardPipe() = default;
+
+    virtual void initialize(const int channels) = 0;
+    virtual std::string get_name() const = 0;
+    virtual Precision get_precision() const {
+        return Precision::SINGLE;
+    }
+    // Maximum amount of positions forward_batch evaluates in one go.
+    virtual size_t get_max_batch_size() const {
+        return 1;
+    }
+
+    virtual void push_input_convolution(unsigned int filter_size,
+                                        unsigned int channels,
+                                        unsigned int outputs,
+                                        const std::vector<float>& weights,
+                                        const std::vector<float>& means,
+                                        const std::vector<float>& variances) = 0;
+
+    virtual void push_residual(unsigned int filter_size,
+                               unsigned int channels,
+                               unsigned int outputs,
+                               const std::vector<float>& weights_1,
+                               const std::vector<float>& means_1,
+                               const std::vector<float>& variances_1,
+                               const std::vector<float>& weights_2,
+                               const std::vector<float>& means_2,
+                               const std::vector<float>& variances_2) = 0;
+
+    virtual void push_convolve1(unsigned int channels,
+                                unsigned int outputs,
+                                const std::vector<float>& weights) = 0;
+
+    // Batchnorm of the policy convolution and the fully connected
+    // layer, weights [moves][inputs].
+    virtual void push_policy_head(const std::vector<float>& means,
+                                  const std::vector<float>& stddivs,
+                                  const std::vector<float>& ip_w,
+                                  const std::vector<float>& ip_b) = 0;
+
+    // Batchnorm of the value convolution and the two fully connected
+    // layers, weights [outputs][inputs].
+    virtual void push_value_head(const std::vector<float>& means,
+                                 const std::vector<float>& stddivs,
+                                 const std::vector<float>& ip1_w,
+                                 const std::vector<float>& ip1_b,
+                                 const std::vector<float>& ip2_w,
+                                 const std::vector<float>& ip2_b) = 0;
+
+    virtual void forward(const std::vector<float>& input,
+                         std::vector<float>& output_pol,
+                         std::vector<float>& output_val) = 0;
+
+    // Evaluate batch_size positions, stored back to back in the
+    // input and output vectors. Backends that can't do better
+    // evaluate them one by one.
+    virtual void forward_batch(const size_t batch_size,
+                               const std::vector<float>& input,
+                               std::vector<float>& output_pol,
+                               std::vector<float>& output_val) {
+        assert(input.size() % batch_size == 0);
+        assert(output_pol.size() % batch_size == 0);
+        assert(output_val.size() % batch_size == 0);
+        const auto in_size = input.size() / batch_size;
+        const auto pol_size = output_pol.size() / batch_size;
+        const auto val_size = output_val.size() / batch_size;
+
+        auto in = std::vector<float>(in_size);
+        auto pol = std::vector<float>(pol_size);
+        auto val = std::vector<float>(val_size);
+        for (auto i = size_t{0}; i < batch_size; i++) {
+            std::copy(begin(input) + i * in_size,
+                      begin(input) + (i + 1) * in_size,
+                      begin(in));
+            forward(in, pol, val);
+            std::copy(begin(pol), end(pol), begin(output_pol) + i * pol_size);
+            std::copy(begin(val), end(val), begin(output_val) + i * val_size);
+        }
+    }
+
+    // Evaluate batch_size positions in the packed format of
+    // Network::pack_input. By default they are expanded on the host.
+    virtual void forward_packed(const size_t batch_size,
+                                const std::vector<std::uint32_t>& input,
+                                std::vector<float>& output_pol,
+                                std::vector<float>& output_val);
+
+    // Starts forward_packed and returns before it finishes if the
+    // backend can. The arguments must stay alive until the future is
+    // ready. By default the evaluation is done before returning.
+    virtual std::future<void> forward_packed_async(
+        const size_t batch_size,
+        const std::vector<std::uint32_t>& input,
+        std::vector<float>& output_pol,
+        std::vector<float>& output_val);
+};
+
+#endif
@@ -56,8 +56,17 @@ int cfg_noise;
 int cfg_random_cnt;
 std::uint64_t cfg_rng_seed;
 bool cfg_dumbpass;
+std::string cfg_backend;
+int cfg_input_cache_mb;
+int cfg_leaf_batch;
+int cfg_eval_threads;
+int cfg_batches_in_flight;
+bool cfg_transpositions;
 #ifdef USE_OPENCL
 std::vector<int> cfg_gpus;
+int cfg_batch_size;
+std::string cfg_precision;
+float cfg_selfcheck_budget;
 bool cfg_sgemm_exhaustive;
 bool cfg_tune_only;
 #endif
@@ -77,8 +86,18 @@ void GTP::setup_default_parameters() {
     cfg_max_playouts = std::numeric_limits<decltype(cfg_max_playouts)>::max();
     cfg_max_visits = std::numeric_limits<decltype(cfg_max_visits)>::max();
     cfg_lagbuffer_cs = 100;
+    cfg_backend = "auto";
+    cfg_input_cache_mb = 0;
+    cfg_leaf_batch = 1;
+    cfg_eval_threads = 0;
+    cfg_batches_in_flight = 1;
+    cfg_transpositions = false;
 #ifdef USE_OPENCL
     cfg_gpus = { };
+    cfg_batch_size = 1;
+    cfg_precision = "auto";
+    // Percentage of one CPU core
+    cfg_selfcheck_budget = 5.0f;
     cfg_sgemm_exhaustive = false;
     cfg_tune_only = false;
 #endif
@@ -673,6 +692,21 @@ bool GTP::execute(GameState & game, std::string xinput) {
         }
         gtp_printf(id, "");
         return true;
+    } else if (command.find("treebench") == 0) {
+        std::istringstream cmdstream(command);
+        std::string tmp;
+        int max_threads;
+
+        cmdstream >> tmp;  // eat treebench
+        cmdstream >> max_threads;
+
+        if (!cmdstream.fail()) {
+            UCTSearch::tree_benchmark(game, max_threads);
+        } else {
+            UCTSearch::tree_benchmark(game);
+        }
+        gtp_printf(id, "");
+        return true;
 
     } else if (command.find("printsgf") == 0) {
         std::istringstream cmdstream(command);
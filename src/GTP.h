@@ -38,8 +38,17 @@ extern int cfg_noise;
 extern int cfg_random_cnt;
 extern std::uint64_t cfg_rng_seed;
 extern bool cfg_dumbpass;
+extern std::string cfg_backend;
+extern int cfg_input_cache_mb;
+extern int cfg_leaf_batch;
+extern int cfg_eval_threads;
+extern int cfg_batches_in_flight;
+extern bool cfg_transpositions;
 #ifdef USE_OPENCL
 extern std::vector<int> cfg_gpus;
+extern int cfg_batch_size;
+extern std::string cfg_precision;
+extern float cfg_selfcheck_budget;
 extern bool cfg_sgemm_exhaustive;
 extern bool cfg_tune_only;
 #endif
@@ -0,0 +1,173 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "HybridPipe.h"
+
+#include <algorithm>
+#include <cassert>
+
+void HybridPipe::add_pipe(std::shared_ptr<ForwardPipe> pipe,
+                          const float throughput) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pipes.push_back({std::move(pipe), std::max(throughput, 1.0f), 0.0f});
+}
+
+void HybridPipe::initialize(const int channels) {
+    for (auto& backend : m_pipes) {
+        backend.pipe->initialize(channels);
+    }
+}
+
+std::string HybridPipe::get_name() const {
+    auto name = std::string{};
+    for (const auto& backend : m_pipes) {
+        if (!name.empty()) {
+            name += " + ";
+        }
+        name += backend.pipe->get_name();
+    }
+    return name;
+}
+
+ForwardPipe::Precision HybridPipe::get_precision() const {
+    for (const auto& backend : m_pipes) {
+        if (backend.pipe->get_precision() == Precision::HALF) {
+            return Precision::HALF;
+        }
+    }
+    return Precision::SINGLE;
+}
+
+size_t HybridPipe::get_max_batch_size() const {
+    auto batch_size = size_t{1};
+    for (const auto& backend : m_pipes) {
+        batch_size = std::max(batch_size, backend.pipe->get_max_batch_size());
+    }
+    return batch_size;
+}
+
+void HybridPipe::push_input_convolution(unsigned int filter_size,
+                                        unsigned int channels,
+                                        unsigned int outputs,
+                                        const std::vector<float>& weights,
+                                        const std::vector<float>& means,
+                                        const std::vector<float>& variances) {
+    for (auto& backend : m_pipes) {
+        backend.pipe->push_input_convolution(filter_size, channels, outputs,
+                                             weights, means, variances);
+    }
+}
+
+void HybridPipe::push_residual(unsigned int filter_size,
+                               unsigned int channels,
+                               unsigned int outputs,
+                               const std::vector<float>& weights_1,
+                               const std::vector<float>& means_1,
+                               const std::vector<float>& variances_1,
+                               const std::vector<float>& weights_2,
+                               const std::vector<float>& means_2,
+                               const std::vector<float>& variances_2) {
+    for (auto& backend : m_pipes) {
+        backend.pipe->push_residual(filter_size, channels, outputs,
+                                    weights_1, means_1, variances_1,
+                                    weights_2, means_2, variances_2);
+    }
+}
+
+void HybridPipe::push_convolve1(unsigned int channels,
+                                unsigned int outputs,
+                                const std::vector<float>& weights) {
+    for (auto& backend : m_pipes) {
+        backend.pipe->push_convolve1(channels, outputs, weights);
+    }
+}
+
+void HybridPipe::push_policy_head(const std::vector<float>& means,
+                                  const std::vector<float>& stddivs,
+                                  const std::vector<float>& ip_w,
+                                  const std::vector<float>& ip_b) {
+    for (auto& backend : m_pipes) {
+        backend.pipe->push_policy_head(means, stddivs, ip_w, ip_b);
+    }
+}
+
+void HybridPipe::push_value_head(const std::vector<float>& means,
+                                 const std::vector<float>& stddivs,
+                                 const std::vector<float>& ip1_w,
+                                 const std::vector<float>& ip1_b,
+                                 const std::vector<float>& ip2_w,
+                                 const std::vector<float>& ip2_b) {
+    for (auto& backend : m_pipes) {
+        backend.pipe->push_value_head(means, stddivs,
+                                      ip1_w, ip1_b, ip2_w, ip2_b);
+    }
+}
+
+ForwardPipe& HybridPipe::pick_pipe(const size_t positions) {
+    // Smooth weighted round robin: every backend earns credit in
+    // proportion to its throughput, the richest one gets the work
+    // and pays for the positions in it. This interleaves the backends
+    // evenly instead of sending bursts to each of them.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    assert(!m_pipes.empty());
+    auto total = 0.0f;
+    for (const auto& backend : m_pipes) {
+        total += backend.throughput;
+    }
+    auto best = size_t{0};
+    for (auto i = size_t{0}; i < m_pipes.size(); i++) {
+        m_pipes[i].credit += positions * m_pipes[i].throughput / total;
+        if (m_pipes[i].credit > m_pipes[best].credit) {
+            best = i;
+        }
+    }
+    m_pipes[best].credit -= positions;
+    return *m_pipes[best].pipe;
+}
+
+void HybridPipe::forward(const std::vector<float>& input,
+                         std::vector<float>& output_pol,
+                         std::vector<float>& output_val) {
+    pick_pipe(1).forward(input, output_pol, output_val);
+}
+
+void HybridPipe::forward_batch(const size_t batch_size,
+                               const std::vector<float>& input,
+                               std::vector<float>& output_pol,
+                               std::vector<float>& output_val) {
+    pick_pipe(batch_size).forward_batch(batch_size, input,
+                                        output_pol, output_val);
+}
+
+void HybridPipe::forward_packed(const size_t batch_size,
+                                const std::vector<std::uint32_t>& input,
+                                std::vector<float>& output_pol,
+                                std::vector<float>& output_val) {
+    pick_pipe(batch_size).forward_packed(batch_size, input,
+                                         output_pol, output_val);
+}
+
+std::future<void> HybridPipe::forward_packed_async(
+    const size_t batch_size,
+    const std::vector<std::uint32_t>& input,
+    std::vector<float>& output_pol,
+    std::vector<float>& output_val) {
+    return pick_pipe(batch_size).forward_packed_async(batch_size, input,
+                                                      output_pol, output_val);
+}
@@ -0,0 +1,115 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HYBRIDPIPE_H_INCLUDED
+#define HYBRIDPIPE_H_INCLUDED
+
+#include "config.h"
+
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ForwardPipe.h"
+
+/*
+    Spreads evaluations over several backends at once, typically the
+    OpenCL devices and the CPU cores that would otherwise sit waiting
+    for them. Every backend gets a share of the evaluated positions
+    proportional to its throughput, so the combined throughput is their
+    sum. Batches go to one backend as a whole, the largest batch is that
+    of the backend that takes the largest ones.
+*/
+class HybridPipe : public ForwardPipe {
+public:
+    // Add a backend able to do 'throughput' evaluations per second.
+    void add_pipe(std::shared_ptr<ForwardPipe> pipe, const float throughput);
+
+    virtual void initialize(const int channels);
+    virtual std::string get_name() const;
+    virtual Precision get_precision() const;
+    virtual size_t get_max_batch_size() const;
+
+    virtual void push_input_convolution(unsigned int filter_size,
+                                        unsigned int channels,
+                                        unsigned int outputs,
+                                        const std::vector<float>& weights,
+                                        const std::vector<float>& means,
+                                        const std::vector<float>& variances);
+
+    virtual void push_residual(unsigned int filter_size,
+                               unsigned int channels,
+                               unsigned int outputs,
+                               const std::vector<float>& weights_1,
+                               const std::vector<float>& means_1,
+                               const std::vector<float>& variances_1,
+                               const std::vector<float>& weights_2,
+                               const std::vector<float>& means_2,
+                               const std::vector<float>& variances_2);
+
+    virtual void push_convolve1(unsigned int channels,
+                                unsigned int outputs,
+                                const std::vector<float>& weights);
+
+    virtual void push_policy_head(const std::vector<float>& means,
+                                  const std::vector<float>& stddivs,
+                                  const std::vector<float>& ip_w,
+                                  const std::vector<float>& ip_b);
+
+    virtual void push_value_head(const std::vector<float>& means,
+                                 const std::vector<float>& stddivs,
+                                 const std::vector<float>& ip1_w,
+                                 const std::vector<float>& ip1_b,
+                                 const std::vector<float>& ip2_w,
+                                 const std::vector<float>& ip2_b);
+
+    virtual void forward(const std::vector<float>& input,
+                         std::vector<float>& output_pol,
+                         std::vector<float>& output_val);
+    virtual void forward_batch(const size_t batch_size,
+                               const std::vector<float>& input,
+                               std::vector<float>& output_pol,
+                               std::vector<float>& output_val);
+    virtual void forward_packed(const size_t batch_size,
+                                const std::vector<std::uint32_t>& input,
+                                std::vector<float>& output_pol,
+                                std::vector<float>& output_val);
+    virtual std::future<void> forward_packed_async(
+        const size_t batch_size,
+        const std::vector<std::uint32_t>& input,
+        std::vector<float>& output_pol,
+        std::vector<float>& output_val);
+
+private:
+    struct Backend {
+        std::shared_ptr<ForwardPipe> pipe;
+        float throughput;
+        float credit;
+    };
+
+    // The backend that evaluates the next 'positions' positions.
+    ForwardPipe& pick_pipe(const size_t positions);
+
+    std::mutex m_mutex;
+    std::vector<Backend> m_pipes;
+};
+
+#endif
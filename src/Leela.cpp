@@ -25,6 +25,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <string>
 #include <vector>
@@ -35,6 +36,7 @@
 #include "NNCache.h"
 #include "Random.h"
 #include "ThreadPool.h"
+#include "UCTNode.h"
 #include "Utils.h"
 #include "Zobrist.h"
 
@@ -78,9 +80,35 @@ static void parse_commandline(int argc, char *argv[]) {
         ("logfile,l", po::value<std::string>(), "File to log input/output to.")
         ("quiet,q", "Disable all diagnostic output.")
         ("noponder", "Disable thinking on opponent's time.")
+        ("backend", po::value<std::string>()->default_value(cfg_backend),
+                    "Neural network backend: auto, cpu, opencl, hybrid "
+                    "or reference.")
+        ("inputcache", po::value<int>(),
+                       "MiB of memory for reusing input layer results "
+                       "between positions (CPU backend).")
+        ("leaf-batch", po::value<int>(),
+                       "Leaves each search thread collects and evaluates "
+                       "together. Defaults to the OpenCL batch size.")
+        ("eval-threads", po::value<int>()->default_value(cfg_eval_threads),
+                         "Threads that only run network evaluations, "
+                         "leaving the tree search to the other threads.")
+        ("batches-in-flight",
+                       po::value<int>()->default_value(cfg_batches_in_flight),
+                       "Leaf batches each search thread keeps waiting for "
+                       "the network while it walks the tree for the next.")
+        ("transpositions", "Search a graph in which all move orders that "
+                           "reach a position share its node.")
 #ifdef USE_OPENCL
         ("gpu",  po::value<std::vector<int> >(),
                 "ID of the OpenCL device(s) to use (disables autodetection).")
+        ("batchsize", po::value<int>()->default_value(cfg_batch_size),
+                      "Maximum amount of positions per OpenCL evaluation.")
+        ("precision", po::value<std::string>()->default_value(cfg_precision),
+                      "Floating point storage of OpenCL: auto, single "
+                      "or half.")
+        ("selfcheck-budget",
+         po::value<float>()->default_value(cfg_selfcheck_budget),
+         "Percentage of one CPU core used to verify OpenCL results.")
         ("full-tuner", "Try harder to find an optimal OpenCL tuning.")
         ("tune-only", "Tune OpenCL only and then exit.")
 #endif
@@ -150,6 +178,23 @@ static void parse_commandline(int argc, char *argv[]) {
         cfg_logfile_handle = fopen(cfg_logfile.c_str(), "a");
     }
 
+    if (vm.count("backend")) {
+        cfg_backend = vm["backend"].as<std::string>();
+        if (cfg_backend != "auto" && cfg_backend != "cpu"
+            && cfg_backend != "reference"
+#ifdef USE_OPENCL
+            && cfg_backend != "opencl" && cfg_backend != "hybrid"
+#endif
+            ) {
+            myprintf("Unknown or unavailable backend: %s\n", cfg_backend.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (vm.count("inputcache")) {
+        cfg_input_cache_mb = std::max(0, vm["inputcache"].as<int>());
+    }
+
     if (vm.count("weights")) {
         cfg_weightsfile = vm["weights"].as<std::string>();
     } else {
@@ -227,6 +272,24 @@ static void parse_commandline(int argc, char *argv[]) {
         cfg_gpus = vm["gpu"].as<std::vector<int> >();
     }
 
+    if (vm.count("batchsize")) {
+        cfg_batch_size = std::max(1, vm["batchsize"].as<int>());
+    }
+
+    if (vm.count("precision")) {
+        cfg_precision = vm["precision"].as<std::string>();
+        if (cfg_precision != "auto" && cfg_precision != "single"
+            && cfg_precision != "half") {
+            myprintf("Unknown precision: %s\n", cfg_precision.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (vm.count("selfcheck-budget")) {
+        cfg_selfcheck_budget =
+            std::max(0.0f, vm["selfcheck-budget"].as<float>());
+    }
+
     if (vm.count("full-tuner")) {
         cfg_sgemm_exhaustive = true;
     }
@@ -236,6 +299,62 @@ static void parse_commandline(int argc, char *argv[]) {
     }
 #endif
 
+#ifdef USE_OPENCL
+    // Collect as many leaves as the devices evaluate at once.
+    cfg_leaf_batch = cfg_batch_size;
+#endif
+    if (vm.count("leaf-batch")) {
+        cfg_leaf_batch = std::max(1, vm["leaf-batch"].as<int>());
+    }
+
+    if (vm.count("eval-threads")) {
+        cfg_eval_threads = std::max(0, vm["eval-threads"].as<int>());
+    }
+
+    if (vm.count("batches-in-flight")) {
+        cfg_batches_in_flight =
+            std::max(1, vm["batches-in-flight"].as<int>());
+    }
+
+    // Every leaf in flight holds a virtual loss on the root, which has
+    // to fit in its 16 bit counter.
+    const auto leaves_in_flight = []() -> std::int64_t {
+        if (cfg_eval_threads > 0) {
+            // Queued for or being evaluated, and one being walked by
+            // every search thread.
+            return 2 * std::int64_t{cfg_eval_threads} * cfg_leaf_batch
+                   + cfg_num_threads;
+        }
+        return std::int64_t{cfg_num_threads} * cfg_batches_in_flight
+               * cfg_leaf_batch;
+    };
+    constexpr auto max_leaves_in_flight =
+        std::numeric_limits<std::int16_t>::max()
+        / UCTNode::VIRTUAL_LOSS_COUNT;
+    if (leaves_in_flight() > max_leaves_in_flight) {
+        if (cfg_eval_threads > 0) {
+            cfg_leaf_batch = std::max(1,
+                (max_leaves_in_flight - cfg_num_threads)
+                / (2 * cfg_eval_threads));
+        } else {
+            const auto max_batches = max_leaves_in_flight / cfg_num_threads;
+            cfg_batches_in_flight = std::max(1,
+                std::min(cfg_batches_in_flight,
+                         max_batches / cfg_leaf_batch));
+            cfg_leaf_batch = std::max(1,
+                std::min(cfg_leaf_batch,
+                         max_batches / cfg_batches_in_flight));
+        }
+        myprintf("Clamping leaves in flight to %d: "
+                 "leaf batch %d, batches in flight %d.\n",
+                 int(leaves_in_flight()),
+                 cfg_leaf_batch, cfg_batches_in_flight);
+    }
+
+    if (vm.count("transpositions")) {
+        cfg_transpositions = true;
+    }
+
     auto out = std::stringstream{};
     for (auto i = 1; i < argc; i++) {
         out << " " << argv[i];
@@ -248,7 +367,7 @@ static void parse_commandline(int argc, char *argv[]) {
 
 // Setup global objects after command line has been parsed
 void init_global_objects() {
-    thread_pool.initialize(cfg_num_threads);
+    thread_pool.initialize(cfg_num_threads + cfg_eval_threads);
 
     // Use deterministic random numbers for hashing
     auto rng = std::make_unique<Random>(5489);
@@ -0,0 +1,118 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOCKFREEQUEUE_H_INCLUDED
+#define LOCKFREEQUEUE_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+/*
+    Bounded queue for any number of producers and consumers, after
+    Dmitry Vyukov's design. Every cell carries a sequence number that
+    tells whether it is ready to be written or read in the current lap
+    of the ring, so a push or pop is a single compare-and-swap on the
+    position unless it races with another thread. Nobody ever waits
+    for a lock.
+*/
+template <typename T>
+class LockFreeQueue {
+public:
+    // Capacity is rounded up to a power of two.
+    explicit LockFreeQueue(const size_t capacity) {
+        auto size = size_t{1};
+        while (size < capacity) {
+            size *= 2;
+        }
+        m_mask = size - 1;
+        m_cells = std::make_unique<Cell[]>(size);
+        for (auto i = size_t{0}; i < size; i++) {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // Returns false if the queue is full.
+    bool push(T&& value) {
+        auto pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            auto& cell = m_cells[pos & m_mask];
+            const auto seq = cell.sequence.load(std::memory_order_acquire);
+            const auto diff = std::ptrdiff_t(seq) - std::ptrdiff_t(pos);
+            if (diff == 0) {
+                if (m_enqueue_pos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.data = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Returns false if the queue is empty.
+    bool pop(T& value) {
+        auto pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            auto& cell = m_cells[pos & m_mask];
+            const auto seq = cell.sequence.load(std::memory_order_acquire);
+            const auto diff = std::ptrdiff_t(seq) - std::ptrdiff_t(pos + 1);
+            if (diff == 0) {
+                if (m_dequeue_pos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed)) {
+                    value = std::move(cell.data);
+                    cell.sequence.store(pos + m_mask + 1,
+                                        std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Only a hint while other threads push or pop.
+    bool empty() const {
+        return m_enqueue_pos.load(std::memory_order_acquire)
+               == m_dequeue_pos.load(std::memory_order_acquire);
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+    size_t m_mask;
+    // On separate cache lines, producers and consumers don't disturb
+    // each other.
+    alignas(64) std::atomic<size_t> m_enqueue_pos{0};
+    alignas(64) std::atomic<size_t> m_dequeue_pos{0};
+};
+
+#endif
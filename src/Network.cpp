@@ -22,6 +22,7 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <cmath>
 #include <iterator>
@@ -43,17 +44,22 @@
 #endif
 #ifdef USE_OPENCL
 #include "OpenCLScheduler.h"
-#include "UCTNode.h"
 #endif
 
+#include "CPUPipe.h"
+#ifdef USE_OPENCL_SELFCHECK
+#include "SelfCheck.h"
+#endif
 #include "FastBoard.h"
 #include "FastState.h"
+#include "ForwardPipe.h"
 #include "FullBoard.h"
 #include "GameState.h"
 #include "GTP.h"
-#include "Im2Col.h"
+#include "HybridPipe.h"
 #include "NNCache.h"
 #include "Random.h"
+#include "ReferencePipe.h"
 #include "ThreadPool.h"
 #include "Timing.h"
 #include "Utils.h"
@@ -91,6 +97,13 @@ static std::array<float, 1> ip2_val_b;
 // Rotation helper
 static std::array<std::array<int, 361>, 8> rotate_nn_idx_table;
 
+// Backend computing the residual tower and the head convolutions
+static std::shared_ptr<ForwardPipe> forward_pipe;
+#ifdef USE_OPENCL_SELFCHECK
+// Verifies results of the OpenCL backend against the CPU backend
+static std::unique_ptr<SelfCheck> selfcheck;
+#endif
+
 void Network::benchmark(const GameState * state, int iterations) {
     int cpus = cfg_num_threads;
     int iters_per_thread = (iterations + (cpus - 1)) / cpus;
@@ -318,6 +331,253 @@ std::pair<int, int> Network::load_network_file(std::string filename) {
     return {0, 0};
 }
 
+static std::unique_ptr<ForwardPipe> make_pipe(
+    const std::string& backend,
+    const size_t channels,
+    const size_t residual_blocks,
+    const ForwardPipe::Precision precision = ForwardPipe::Precision::SINGLE) {
+    auto pipe = std::unique_ptr<ForwardPipe>{};
+#ifdef USE_OPENCL
+    if (backend == "opencl") {
+        myprintf("Initializing OpenCL (%s precision).\n",
+                 precision == ForwardPipe::Precision::HALF ? "half" : "single");
+        pipe = std::make_unique<OpenCLScheduler>(precision);
+    }
+#else
+    (void)precision;
+#endif
+    if (backend == "reference") {
+        pipe = std::make_unique<ReferencePipe>();
+    } else if (backend == "cpu") {
+        pipe = std::make_unique<CPUPipe>();
+    }
+    assert(pipe);
+    pipe->initialize(channels);
+
+    auto weight_index = size_t{0};
+    // Input convolution
+    pipe->push_input_convolution(3, Network::INPUT_CHANNELS, channels,
+                                 conv_weights[weight_index],
+                                 batchnorm_means[weight_index],
+                                 batchnorm_stddivs[weight_index]);
+    weight_index++;
+
+    // Residual blocks
+    for (auto i = size_t{0}; i < residual_blocks; i++) {
+        pipe->push_residual(3, channels, channels,
+                            conv_weights[weight_index],
+                            batchnorm_means[weight_index],
+                            batchnorm_stddivs[weight_index],
+                            conv_weights[weight_index + 1],
+                            batchnorm_means[weight_index + 1],
+                            batchnorm_stddivs[weight_index + 1]);
+        weight_index += 2;
+    }
+
+    // Output head convolutions
+    pipe->push_convolve1(channels, Network::OUTPUTS_POLICY, conv_pol_w);
+    pipe->push_convolve1(channels, Network::OUTPUTS_VALUE, conv_val_w);
+
+    // Fully connected heads
+    pipe->push_policy_head({begin(bn_pol_w1), end(bn_pol_w1)},
+                           {begin(bn_pol_w2), end(bn_pol_w2)},
+                           {begin(ip_pol_w), end(ip_pol_w)},
+                           {begin(ip_pol_b), end(ip_pol_b)});
+    pipe->push_value_head({begin(bn_val_w1), end(bn_val_w1)},
+                          {begin(bn_val_w2), end(bn_val_w2)},
+                          {begin(ip1_val_w), end(ip1_val_w)},
+                          {begin(ip1_val_b), end(ip1_val_b)},
+                          {begin(ip2_val_w), end(ip2_val_w)},
+                          {begin(ip2_val_b), end(ip2_val_b)});
+
+    return pipe;
+}
+
+// Empty board positions, black to move, with one stone in the first
+// history plane that differs between the positions of the batch.
+static std::vector<float> make_test_batch(const size_t batch_size) {
+    constexpr auto board_squares = 19 * 19;
+    constexpr auto input_size = Network::INPUT_CHANNELS * board_squares;
+    auto input = std::vector<float>(batch_size * input_size);
+    for (auto i = size_t{0}; i < batch_size; i++) {
+        const auto position = begin(input) + i * input_size;
+        std::fill(position + 2 * Network::INPUT_MOVES * board_squares,
+                  position + (2 * Network::INPUT_MOVES + 1) * board_squares,
+                  1.0f);
+        if (i > 0) {
+            position[(i * 37) % board_squares] = 1.0f;
+        }
+    }
+    return input;
+}
+
+// Writes the bits of a different number for each position into its
+// history boards, on the last squares of the board. No backend has
+// seen the boards before, so none can take them from a cache.
+static void mark_test_batch(std::vector<float>& input,
+                            const size_t batch_size,
+                            const std::uint32_t first_mark) {
+    constexpr auto board_squares = 19 * 19;
+    constexpr auto input_size = Network::INPUT_CHANNELS * board_squares;
+    constexpr auto mark_bits = 32;
+    for (auto i = size_t{0}; i < batch_size; i++) {
+        const auto mark = first_mark + std::uint32_t(i);
+        for (auto plane = 0; plane < 2 * Network::INPUT_MOVES; plane++) {
+            const auto row = begin(input) + i * input_size
+                             + (plane + 1) * board_squares - mark_bits;
+            for (auto bit = 0; bit < mark_bits; bit++) {
+                row[bit] = float((mark >> bit) & 1);
+            }
+        }
+    }
+}
+
+#ifdef USE_OPENCL_SELFCHECK
+// Check that every position of a batch gives the same result as
+// evaluating it on its own with the reference pipe.
+static void selfcheck_batch(ForwardPipe& pipe, ForwardPipe& ref) {
+    constexpr auto board_squares = 19 * 19;
+    constexpr auto input_size = Network::INPUT_CHANNELS * board_squares;
+    constexpr auto pol_size = Network::POTENTIAL_MOVES;
+    constexpr auto val_size = 1;
+    const auto batch_size = pipe.get_max_batch_size();
+    const auto input = make_test_batch(batch_size);
+    auto output_pol = std::vector<float>(batch_size * pol_size);
+    auto output_val = std::vector<float>(batch_size * val_size);
+    pipe.forward_batch(batch_size, input, output_pol, output_val);
+
+    auto in = std::vector<float>(input_size);
+    auto ref_pol = std::vector<float>(pol_size);
+    auto ref_val = std::vector<float>(val_size);
+    for (auto i = size_t{0}; i < batch_size; i++) {
+        std::copy(begin(input) + i * input_size,
+                  begin(input) + (i + 1) * input_size, begin(in));
+        ref.forward(in, ref_pol, ref_val);
+        auto pol = std::vector<float>(begin(output_pol) + i * pol_size,
+                                      begin(output_pol) + (i + 1) * pol_size);
+        auto val = std::vector<float>(begin(output_val) + i * val_size,
+                                      begin(output_val) + (i + 1) * val_size);
+        SelfCheck::compare(pol, ref_pol);
+        SelfCheck::compare(val, ref_val);
+    }
+}
+#endif
+
+// Evaluations per second of a backend on nearly empty boards,
+// using as many threads as the search will. Every evaluation is of
+// positions the backend hasn't seen yet.
+static float benchmark_pipe(ForwardPipe& pipe, const double seconds = 1.0) {
+    const auto batch_size = pipe.get_max_batch_size();
+    const auto input = make_test_batch(batch_size);
+    auto output_pol = std::vector<float>(
+        batch_size * Network::POTENTIAL_MOVES);
+    auto output_val = std::vector<float>(batch_size);
+    // Warm up, lazy initialization shouldn't count.
+    pipe.forward_batch(batch_size, input, output_pol, output_val);
+
+    std::atomic<int> evals{0};
+    // The warm up saw the unmarked boards.
+    std::atomic<std::uint32_t> next_mark{1};
+    Time start;
+    ThreadGroup tg(thread_pool);
+    for (auto i = 0; i < cfg_num_threads; i++) {
+        tg.add_task([&pipe, &input, &evals, &next_mark,
+                     start, seconds, batch_size]() {
+            auto in = input;
+            auto pol = std::vector<float>(
+                batch_size * Network::POTENTIAL_MOVES);
+            auto val = std::vector<float>(batch_size);
+            do {
+                mark_test_batch(in, batch_size,
+                                next_mark.fetch_add(batch_size));
+                pipe.forward_batch(batch_size, in, pol, val);
+                evals += batch_size;
+            } while (Time::timediff_seconds(start, Time()) < seconds);
+        });
+    }
+    tg.wait_all();
+    Time end;
+
+    return evals / float(Time::timediff_seconds(start, end));
+}
+
+#ifdef USE_OPENCL
+// Whether the move probabilities and the winrate of a backend are within
+// a few percent of the reference on the test positions.
+static bool check_accuracy(ForwardPipe& pipe, ForwardPipe& ref) {
+    constexpr auto positions = 8;
+    constexpr auto input_size = Network::INPUT_CHANNELS * 19 * 19;
+    constexpr auto max_error = 0.05f;
+    const auto input = make_test_batch(positions);
+
+    auto in = std::vector<float>(input_size);
+    auto pol = std::vector<float>(Network::POTENTIAL_MOVES);
+    auto ref_pol = std::vector<float>(Network::POTENTIAL_MOVES);
+    auto probs = std::vector<float>(Network::POTENTIAL_MOVES);
+    auto ref_probs = std::vector<float>(Network::POTENTIAL_MOVES);
+    auto val = std::vector<float>(1);
+    auto ref_val = std::vector<float>(1);
+    auto policy_error = 0.0f;
+    auto winrate_error = 0.0f;
+    for (auto i = 0; i < positions; i++) {
+        std::copy(begin(input) + i * input_size,
+                  begin(input) + (i + 1) * input_size, begin(in));
+        pipe.forward(in, pol, val);
+        ref.forward(in, ref_pol, ref_val);
+        Network::softmax(pol, probs);
+        Network::softmax(ref_pol, ref_probs);
+        for (auto m = size_t{0}; m < probs.size(); m++) {
+            policy_error = std::max(policy_error,
+                                    std::abs(probs[m] - ref_probs[m]));
+        }
+        winrate_error = std::max(winrate_error,
+                                 std::abs(fast_tanh(val[0])
+                                          - fast_tanh(ref_val[0])) / 2.0f);
+    }
+    myprintf("Largest error: policy %.4f, winrate %.4f\n",
+             policy_error, winrate_error);
+    return policy_error < max_error && winrate_error < max_error;
+}
+
+// Half precision is used when the device supports it and it is accurate
+// enough, in auto mode only when it is also faster.
+static std::unique_ptr<ForwardPipe> make_opencl_pipe(
+    const size_t channels, const size_t residual_blocks) {
+    if (cfg_precision == "single") {
+        return make_pipe("opencl", channels, residual_blocks);
+    }
+
+    auto half = std::unique_ptr<ForwardPipe>{};
+    try {
+        half = make_pipe("opencl", channels, residual_blocks,
+                         ForwardPipe::Precision::HALF);
+        auto ref = make_pipe("cpu", channels, residual_blocks);
+        if (!check_accuracy(*half, *ref)) {
+            myprintf("Half precision is not accurate enough.\n");
+            half.reset();
+        }
+    } catch (const std::exception& e) {
+        myprintf("Half precision unavailable: %s\n", e.what());
+        half.reset();
+    }
+    if (half && cfg_precision == "half") {
+        return half;
+    }
+
+    auto single = make_pipe("opencl", channels, residual_blocks);
+    if (half) {
+        const auto half_rate = benchmark_pipe(*half);
+        const auto single_rate = benchmark_pipe(*single);
+        myprintf("OpenCL half precision: %d n/s, single precision: %d n/s\n",
+                 int(half_rate), int(single_rate));
+        if (half_rate > single_rate) {
+            return half;
+        }
+    }
+    return single;
+}
+#endif
+
 void Network::initialize(void) {
     // Prepare rotation table
     for(auto s = 0; s < 8; s++) {
@@ -333,22 +593,6 @@ void Network::initialize(void) {
         exit(EXIT_FAILURE);
     }
 
-    auto weight_index = size_t{0};
-    // Input convolution
-    // Winograd transform convolution weights
-    conv_weights[weight_index] =
-        winograd_transform_f(conv_weights[weight_index],
-                             channels, INPUT_CHANNELS);
-    weight_index++;
-
-    // Residual block convolutions
-    for (auto i = size_t{0}; i < residual_blocks * 2; i++) {
-		conv_weights[weight_index] =
-            winograd_transform_f(conv_weights[weight_index],
-                                 channels, channels);
-        weight_index++;
-    }
-
     // Biases are not calculated and are typically zero but some networks might
     // still have non-zero biases.
     // Move biases to batchnorm means to make the output match without having
@@ -370,54 +614,6 @@ void Network::initialize(void) {
         conv_pol_b[i] = 0.0f;
     }
 
-#ifdef USE_OPENCL
-    myprintf("Initializing OpenCL.\n");
-    opencl.initialize(channels);
-
-    for(auto & opencl_net : opencl.get_networks()) {
-        auto tuners = opencl_net->getOpenCL().get_sgemm_tuners();
-
-        auto mwg = tuners[0];
-        auto kwg = tuners[2];
-        auto vwm = tuners[3];
-
-        weight_index = 0;
-
-        size_t m_ceil = ceilMultiple(ceilMultiple(channels, mwg), vwm);
-        size_t k_ceil = ceilMultiple(ceilMultiple(INPUT_CHANNELS, kwg), vwm);
-
-        auto Upad = zeropad_U(conv_weights[weight_index],
-                              channels, INPUT_CHANNELS,
-                              m_ceil, k_ceil);
-
-        // Winograd filter transformation changes filter size to 4x4
-        opencl_net->push_input_convolution(WINOGRAD_ALPHA, INPUT_CHANNELS, channels,
-                Upad, batchnorm_means[weight_index], batchnorm_stddivs[weight_index]);
-        weight_index++;
-
-        // residual blocks
-        for (auto i = size_t{0}; i < residual_blocks; i++) {
-            auto Upad1 = zeropad_U(conv_weights[weight_index],
-                                   channels, channels,
-                                   m_ceil, m_ceil);
-            auto Upad2 = zeropad_U(conv_weights[weight_index + 1],
-                                   channels, channels,
-                                   m_ceil, m_ceil);
-            opencl_net->push_residual(WINOGRAD_ALPHA, channels, channels,
-                                      Upad1,
-                                      batchnorm_means[weight_index],
-                                      batchnorm_stddivs[weight_index],
-                                      Upad2,
-                                      batchnorm_means[weight_index + 1],
-                                      batchnorm_stddivs[weight_index + 1]);
-            weight_index += 2;
-        }
-
-        // Output head convolutions
-        opencl_net->push_convolve1(channels, OUTPUTS_POLICY, conv_pol_w);
-        opencl_net->push_convolve1(channels, OUTPUTS_VALUE, conv_val_w);
-    }
-#endif
 #ifdef USE_BLAS
 #ifndef __APPLE__
 #ifdef USE_OPENBLAS
@@ -433,394 +629,142 @@ void Network::initialize(void) {
 #endif
 #endif
 #endif
-}
-
-#ifdef USE_BLAS
-void Network::winograd_transform_in(const std::vector<float>& in,
-                                    std::vector<float>& V,
-                                    const int C) {
-    constexpr auto W = 19;
-    constexpr auto H = 19;
-    constexpr auto wtiles = (W + 1) / 2;
-    constexpr auto P = wtiles * wtiles;
-
-    for (auto ch = 0; ch < C; ch++) {
-        for (auto block_y = 0; block_y < wtiles; block_y++) {
-            for (auto block_x = 0; block_x < wtiles; block_x++) {
-
-                // Tiles overlap by 2
-                const auto yin = 2 * block_y - 1;
-                const auto xin = 2 * block_x - 1;
-
-                // Cache input tile and handle zero padding
-                using WinogradTile =
-                    std::array<std::array<float, WINOGRAD_ALPHA>, WINOGRAD_ALPHA>;
-                WinogradTile x;
-
-                for (auto i = 0; i < WINOGRAD_ALPHA; i++) {
-                    for (auto j = 0; j < WINOGRAD_ALPHA; j++) {
-                        if ((yin + i) >= 0 && (xin + j) >= 0
-                            && (yin + i) < H && (xin + j) < W) {
-                            x[i][j] = in[ch*(W*H) + (yin+i)*W + (xin+j)];
-                        } else {
-                            x[i][j] = 0.0f;
-                        }
-                    }
-                }
 
-                const auto offset = ch*P + block_y*wtiles + block_x;
-
-                // Calculates transpose(B).x.B
-                // B = [[ 1.0,  0.0,  0.0,  0.0],
-                //      [ 0.0,  1.0, -1.0,  1.0],
-                //      [-1.0,  1.0,  1.0,  0.0],
-                //      [ 0.0,  0.0,  0.0, -1.0]]
-
-                WinogradTile T1, T2;
-
-                T1[0][0] = x[0][0] - x[2][0];
-                T1[0][1] = x[0][1] - x[2][1];
-                T1[0][2] = x[0][2] - x[2][2];
-                T1[0][3] = x[0][3] - x[2][3];
-                T1[1][0] = x[1][0] + x[2][0];
-                T1[1][1] = x[1][1] + x[2][1];
-                T1[1][2] = x[1][2] + x[2][2];
-                T1[1][3] = x[1][3] + x[2][3];
-                T1[2][0] = x[2][0] - x[1][0];
-                T1[2][1] = x[2][1] - x[1][1];
-                T1[2][2] = x[2][2] - x[1][2];
-                T1[2][3] = x[2][3] - x[1][3];
-                T1[3][0] = x[1][0] - x[3][0];
-                T1[3][1] = x[1][1] - x[3][1];
-                T1[3][2] = x[1][2] - x[3][2];
-                T1[3][3] = x[1][3] - x[3][3];
-
-                T2[0][0] = T1[0][0] - T1[0][2];
-                T2[0][1] = T1[0][1] + T1[0][2];
-                T2[0][2] = T1[0][2] - T1[0][1];
-                T2[0][3] = T1[0][1] - T1[0][3];
-                T2[1][0] = T1[1][0] - T1[1][2];
-                T2[1][1] = T1[1][1] + T1[1][2];
-                T2[1][2] = T1[1][2] - T1[1][1];
-                T2[1][3] = T1[1][1] - T1[1][3];
-                T2[2][0] = T1[2][0] - T1[2][2];
-                T2[2][1] = T1[2][1] + T1[2][2];
-                T2[2][2] = T1[2][2] - T1[2][1];
-                T2[2][3] = T1[2][1] - T1[2][3];
-                T2[3][0] = T1[3][0] - T1[3][2];
-                T2[3][1] = T1[3][1] + T1[3][2];
-                T2[3][2] = T1[3][2] - T1[3][1];
-                T2[3][3] = T1[3][1] - T1[3][3];
-
-                for (auto i = 0; i < WINOGRAD_ALPHA; i++) {
-                    for (auto j = 0; j < WINOGRAD_ALPHA; j++) {
-                        V[(i*WINOGRAD_ALPHA + j)*C*P + offset] = T2[i][j];
-                    }
-                }
+    auto pipes = std::vector<std::pair<std::string,
+                                       std::shared_ptr<ForwardPipe>>>{};
+    if (cfg_backend == "auto" || cfg_backend == "hybrid") {
+#ifdef USE_OPENCL
+        // A missing or broken OpenCL driver is not fatal in auto mode.
+        try {
+            pipes.emplace_back("opencl",
+                               make_opencl_pipe(channels, residual_blocks));
+        } catch (const std::exception& e) {
+            if (cfg_backend == "hybrid") {
+                throw;
             }
+            myprintf("OpenCL backend unavailable: %s\n", e.what());
         }
+#endif
+        pipes.emplace_back("cpu", make_pipe("cpu", channels, residual_blocks));
+#ifdef USE_OPENCL
+    } else if (cfg_backend == "opencl") {
+        pipes.emplace_back(cfg_backend,
+                           make_opencl_pipe(channels, residual_blocks));
+#endif
+    } else {
+        pipes.emplace_back(cfg_backend,
+                           make_pipe(cfg_backend, channels, residual_blocks));
     }
-}
-
-void Network::winograd_sgemm(const std::vector<float>& U,
-                             std::vector<float>& V,
-                             std::vector<float>& M,
-                             const int C, const int K) {
-    constexpr auto P = (19 + 1) * (19 + 1) / WINOGRAD_ALPHA;
-
-    for (auto b = 0; b < WINOGRAD_TILE; b++) {
-        auto offset_u = b * K * C;
-        auto offset_v = b * C * P;
-        auto offset_m = b * K * P;
-
-        cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans,
-                    K, P, C,
-                    1.0f,
-                    &U[offset_u], K,
-                    &V[offset_v], P,
-                    0.0f,
-                    &M[offset_m], P);
-    }
-}
-
-void Network::winograd_transform_out(const std::vector<float>& M,
-                                     std::vector<float>& Y,
-                                     const int K) {
-    constexpr auto W = 19;
-    constexpr auto H = 19;
-    constexpr auto wtiles = (W + 1) / 2;
-    constexpr auto P = wtiles * wtiles;
-
-    for (auto k = 0; k < K; k++) {
-        for (auto block_x = 0; block_x < wtiles; block_x++) {
-            for (auto block_y = 0; block_y < wtiles; block_y++) {
-
-                const auto x = 2 * block_x;
-                const auto y = 2 * block_y;
-
-                const auto b = block_y * wtiles + block_x;
-                std::array<float, WINOGRAD_TILE> temp_m;
-                for (auto xi = 0; xi < WINOGRAD_ALPHA; xi++) {
-                    for (auto nu = 0; nu < WINOGRAD_ALPHA; nu++) {
-                        temp_m[xi*WINOGRAD_ALPHA + nu] =
-                            M[xi*(WINOGRAD_ALPHA*K*P) + nu*(K*P)+ k*P + b];
-                    }
-                }
 
-                // Calculates transpose(A).temp_m.A
-                //    A = [1.0,  0.0],
-                //        [1.0,  1.0],
-                //        [1.0, -1.0],
-                //        [0.0, -1.0]]
-
-                auto o11 =
-                    temp_m[0*4 + 0] + temp_m[0*4 + 1] + temp_m[0*4 + 2] +
-                    temp_m[1*4 + 0] + temp_m[1*4 + 1] + temp_m[1*4 + 2] +
-                    temp_m[2*4 + 0] + temp_m[2*4 + 1] + temp_m[2*4 + 2];
-
-                auto o12 =
-                    temp_m[0*4 + 1] - temp_m[0*4 + 2] - temp_m[0*4 + 3] +
-                    temp_m[1*4 + 1] - temp_m[1*4 + 2] - temp_m[1*4 + 3] +
-                    temp_m[2*4 + 1] - temp_m[2*4 + 2] - temp_m[2*4 + 3];
-
-                auto o21 =
-                    temp_m[1*4 + 0] + temp_m[1*4 + 1] + temp_m[1*4 + 2] -
-                    temp_m[2*4 + 0] - temp_m[2*4 + 1] - temp_m[2*4 + 2] -
-                    temp_m[3*4 + 0] - temp_m[3*4 + 1] - temp_m[3*4 + 2];
-
-                auto o22 =
-                    temp_m[1*4 + 1] - temp_m[1*4 + 2] - temp_m[1*4 + 3] -
-                    temp_m[2*4 + 1] + temp_m[2*4 + 2] + temp_m[2*4 + 3] -
-                    temp_m[3*4 + 1] + temp_m[3*4 + 2] + temp_m[3*4 + 3];
-
-                Y[k*(H*W) + (y)*W + (x)] = o11;
-                if (x + 1 < W) {
-                    Y[k*(H*W) + (y)*W + (x+1)] = o12;
-                }
-                if (y + 1 < H) {
-                    Y[k*(H*W) + (y+1)*W + (x)] = o21;
-                    if (x + 1 < W) {
-                        Y[k*(H*W) + (y+1)*W + (x+1)] = o22;
-                    }
-                }
-            }
+    auto best = size_t{0};
+    if (pipes.size() > 1) {
+        auto rates = std::vector<float>{};
+        for (auto& pipe : pipes) {
+            rates.emplace_back(benchmark_pipe(*pipe.second));
+            myprintf("Backend %s: %d n/s\n",
+                     pipe.second->get_name().c_str(), int(rates.back()));
         }
-    }
-}
-
-void Network::winograd_convolve3(const int outputs,
-                                 const std::vector<float>& input,
-                                 const std::vector<float>& U,
-                                 std::vector<float>& V,
-                                 std::vector<float>& M,
-                                 std::vector<float>& output) {
-
-    constexpr unsigned int filter_len = WINOGRAD_ALPHA * WINOGRAD_ALPHA;
-    const auto input_channels = U.size() / (outputs * filter_len);
-
-    winograd_transform_in(input, V, input_channels);
-    winograd_sgemm(U, V, M, input_channels, outputs);
-    winograd_transform_out(M, output, outputs);
-}
 
-template<unsigned int filter_size>
-void convolve(size_t outputs,
-              const std::vector<net_t>& input,
-              const std::vector<float>& weights,
-              const std::vector<float>& biases,
-              std::vector<float>& output) {
-    // fixed for 19x19
-    constexpr unsigned int width = 19;
-    constexpr unsigned int height = 19;
-    constexpr unsigned int board_squares = width * height;
-    constexpr unsigned int filter_len = filter_size * filter_size;
-    const auto input_channels = weights.size() / (biases.size() * filter_len);
-    const auto filter_dim = filter_len * input_channels;
-    assert(outputs * board_squares == output.size());
-
-    std::vector<float> col(filter_dim * width * height);
-    im2col<filter_size>(input_channels, input, col);
-
-    // Weight shape (output, input, filter_size, filter_size)
-    // 96 22 3 3
-    // outputs[96,19x19] = weights[96,22x3x3] x col[22x3x3,19x19]
-    // C←αAB + βC
-    // M Number of rows in matrices A and C.
-    // N Number of columns in matrices B and C.
-    // K Number of columns in matrix A; number of rows in matrix B.
-    // lda The size of the first dimention of matrix A; if you are
-    // passing a matrix A[m][n], the value should be m.
-    //    cblas_sgemm(CblasRowMajor, TransA, TransB, M, N, K, alpha, A, lda, B,
-    //                ldb, beta, C, N);
-
-    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
-                // M        N            K
-                outputs, board_squares, filter_dim,
-                1.0f, &weights[0], filter_dim,
-                &col[0], board_squares,
-                0.0f, &output[0], board_squares);
-
-    for (unsigned int o = 0; o < outputs; o++) {
-        for (unsigned int b = 0; b < board_squares; b++) {
-            output[(o * board_squares) + b] =
-                biases[o] + output[(o * board_squares) + b];
+        // Let the CPU cores evaluate next to the OpenCL devices, each
+        // getting work in proportion to the measured throughput.
+        auto hybrid = std::make_shared<HybridPipe>();
+        for (auto i = size_t{0}; i < pipes.size(); i++) {
+            hybrid->add_pipe(pipes[i].second, rates[i]);
         }
-    }
-}
-
-template<unsigned int inputs,
-         unsigned int outputs,
-         size_t W, size_t B>
-void innerproduct(const std::vector<float>& input,
-                  const std::array<float, W>& weights,
-                  const std::array<float, B>& biases,
-                  std::vector<float>& output) {
-    assert(B == outputs);
-
-    cblas_sgemv(CblasRowMajor, CblasNoTrans,
-                // M     K
-                outputs, inputs,
-                1.0f, &weights[0], inputs,
-                &input[0], 1,
-                0.0f, &output[0], 1);
-
-    auto lambda_ReLU = [](float val) { return (val > 0.0f) ?
-                                       val : 0.0f; };
-
-    for (unsigned int o = 0; o < outputs; o++) {
-        float val = biases[o] + output[o];
-        if (outputs == 256) {
-            val = lambda_ReLU(val);
+        pipes.emplace_back("hybrid", hybrid);
+        if (cfg_backend == "hybrid") {
+            best = pipes.size() - 1;
+        } else {
+            rates.emplace_back(benchmark_pipe(*hybrid));
+            myprintf("Backend %s: %d n/s\n",
+                     hybrid->get_name().c_str(), int(rates.back()));
+            best = std::distance(begin(rates),
+                                 std::max_element(begin(rates), end(rates)));
         }
-        output[o] = val;
     }
-}
+    myprintf("Using %s backend.\n", pipes[best].second->get_name().c_str());
 
-template <size_t spatial_size>
-void batchnorm(size_t channels,
-               std::vector<float>& data,
-               const float* means,
-               const float* stddivs,
-               const float* eltwise = nullptr)
-{
-    auto lambda_ReLU = [](float val) { return (val > 0.0f) ?
-                                       val : 0.0f; };
-
-    for (auto c = size_t{0}; c < channels; ++c) {
-        auto mean = means[c];
-        auto scale_stddiv = stddivs[c];
-
-        if (eltwise == nullptr) {
-            // Classical BN
-            auto arr = &data[c * spatial_size];
-            for (auto b = size_t{0}; b < spatial_size; b++) {
-                arr[b] = lambda_ReLU(scale_stddiv * (arr[b] - mean));
-            }
-        } else {
-            // BN + residual add
-            auto arr = &data[c * spatial_size];
-            auto res = &eltwise[c * spatial_size];
-            for (auto b = size_t{0}; b < spatial_size; b++) {
-                arr[b] = lambda_ReLU(res[b] +
-                                     (scale_stddiv * (arr[b] - mean)));
+#ifdef USE_OPENCL_SELFCHECK
+    if ((pipes[best].first == "opencl" || pipes[best].first == "hybrid")
+        && pipes[best].second->get_precision()
+           == ForwardPipe::Precision::SINGLE) {
+        auto selfcheck_pipe = std::shared_ptr<ForwardPipe>{};
+        for (auto& pipe : pipes) {
+            if (pipe.first == "cpu") {
+                selfcheck_pipe = pipe.second;
             }
         }
+        if (!selfcheck_pipe) {
+            selfcheck_pipe = make_pipe("cpu", channels, residual_blocks);
+        }
+        if (pipes[best].second->get_max_batch_size() > 1) {
+            selfcheck_batch(*pipes[best].second, *selfcheck_pipe);
+        }
+        selfcheck = std::make_unique<SelfCheck>(
+            selfcheck_pipe, cfg_selfcheck_budget / 100.0f);
     }
+#endif
+    forward_pipe = pipes[best].second;
+
+    // The backends keep their own copy of the tower weights.
+    conv_weights.clear();
+    conv_weights.shrink_to_fit();
 }
 
-void Network::forward_cpu(std::vector<float>& input,
-                          std::vector<float>& output_pol,
-                          std::vector<float>& output_val) {
-    // Input convolution
-    constexpr int width = 19;
-    constexpr int height = 19;
-    constexpr int tiles = (width + 1) * (height + 1) / 4;
-    // Calculate output channels
-    const auto output_channels = conv_biases[0].size();
-    //input_channels is the maximum number of input channels of any convolution.
-    //Residual blocks are identical, but the first convolution might be bigger
-    //when the network has very few filters
-    const auto input_channels = std::max(
-            static_cast<size_t>(output_channels),
-            static_cast<size_t>(INPUT_CHANNELS));
-    auto conv_out = std::vector<float>(output_channels * width * height);
-
-    auto V = std::vector<float>(WINOGRAD_TILE * input_channels * tiles);
-    auto M = std::vector<float>(WINOGRAD_TILE * output_channels * tiles);
-
-    winograd_convolve3(output_channels, input, conv_weights[0], V, M, conv_out);
-    batchnorm<361>(output_channels, conv_out,
-                   batchnorm_means[0].data(),
-                   batchnorm_stddivs[0].data());
-
-    // Residual tower
-    auto conv_in = std::vector<float>(output_channels * width * height);
-    auto res = std::vector<float>(output_channels * width * height);
-    for (auto i = size_t{1}; i < conv_weights.size(); i += 2) {
-        auto output_channels = conv_biases[i].size();
-        std::swap(conv_out, conv_in);
-        std::copy(begin(conv_in), end(conv_in), begin(res));
-        winograd_convolve3(output_channels, conv_in,
-	                       conv_weights[i], V, M, conv_out);
-        batchnorm<361>(output_channels, conv_out,
-                       batchnorm_means[i].data(),
-                       batchnorm_stddivs[i].data());
-
-        output_channels = conv_biases[i + 1].size();
-        std::swap(conv_out, conv_in);
-        winograd_convolve3(output_channels, conv_in,
-			               conv_weights[i + 1], V, M, conv_out);
-        batchnorm<361>(output_channels, conv_out,
-                       batchnorm_means[i + 1].data(),
-                       batchnorm_stddivs[i + 1].data(),
-                       res.data());
+#ifdef USE_OPENCL_SELFCHECK
+// Both implementations are available, self-check the OpenCL driver by
+// verifying results with a probability of 1/2000. The CPU evaluation
+// runs in the background, mismatches surface on a later evaluation.
+static void maybe_selfcheck(const std::uint32_t* const packed,
+                            const std::vector<float>& policy_data,
+                            const std::vector<float>& value_data) {
+    if (!selfcheck) {
+        return;
+    }
+    selfcheck->check_failures();
+    if (Random::get_Rng().randfix<SELFCHECK_PROBABILITY>() == 0) {
+        auto input = std::vector<float>(Network::INPUT_CHANNELS * 19 * 19);
+        Network::unpack_input(packed, input.data());
+        selfcheck->submit(input, policy_data, value_data);
     }
-    convolve<1>(OUTPUTS_POLICY, conv_out, conv_pol_w, conv_pol_b, output_pol);
-    convolve<1>(OUTPUTS_VALUE, conv_out, conv_val_w, conv_val_b, output_val);
 }
+#endif
 
-template<typename T>
-T relative_difference(T a, T b) {
-    // Handle NaN
-    if (std::isnan(a) || std::isnan(b)) {
-        return std::numeric_limits<T>::max();
+// Softmax over the policy logits, writing the probabilities of the
+// legal moves straight into the result.
+static void policy_head(const GameState* const state,
+                        std::vector<float>& logits,
+                        const std::array<int, 361>& rotation_table,
+                        std::vector<Network::scored_node>& result) {
+    constexpr auto outputs = Network::POTENTIAL_MOVES;
+    const auto inv_temperature = 1.0f / cfg_softmax_temp;
+    const auto alpha = *std::max_element(begin(logits), end(logits));
+    auto denom = 0.0f;
+    for (auto i = 0; i < outputs; i++) {
+        logits[i] = fast_exp((logits[i] - alpha) * inv_temperature);
+        denom += logits[i];
     }
-
-    constexpr auto small_number = 1e-3f;
-    auto fa = std::fabs(a);
-    auto fb = std::fabs(b);
-
-    if (fa > small_number && fb > small_number) {
-        // Handle sign difference
-        if (((a < 0) != (b < 0)) && (a != 0) && (b != 0)) {
-            return std::numeric_limits<T>::max();
+    const auto scale = 1.0f / denom;
+
+    result.reserve(outputs);
+    for (auto idx = 0; idx < 19 * 19; idx++) {
+        const auto rot_idx = rotation_table[idx];
+        const auto x = rot_idx % 19;
+        const auto y = rot_idx / 19;
+        const auto rot_vtx = state->board.get_vertex(x, y);
+        if (state->board.get_square(rot_vtx) == FastBoard::EMPTY) {
+            result.emplace_back(logits[idx] * scale, rot_vtx);
         }
     }
-
-    // Handle underflow
-    fa = std::max(fa, small_number);
-    fb = std::max(fb, small_number);
-
-    return std::max(fabs((fa - fb) / fa), fabs((fa - fb) / fb));
+    result.emplace_back(logits[19 * 19] * scale, FastBoard::PASS);
 }
 
-void compare_net_outputs(std::vector<float>& data,
-                         std::vector<float>& ref) {
-    // We accept an error up to 5%, but output values
-    // smaller than 1/1000th are "rounded up" for the comparison.
-    constexpr float relative_error = 5e-2f;
-    for (auto idx = size_t{0}; idx < data.size(); ++idx) {
-        auto err = relative_difference(data[idx], ref[idx]);
-        if (err > relative_error) {
-            printf("Error in OpenCL calculation: expected %f got %f "
-                   "(error=%f%%)\n", ref[idx], data[idx], err * 100.0);
-            printf("Update your GPU drivers or reduce the amount of games "
-                   "played simultaneously.\n");
-            throw std::runtime_error("OpenCL self-check mismatch.");
-        }
-    }
+// Winrate from the value head output.
+static float value_head(const float value) {
+    // Sigmoid
+    return (1.0f + fast_tanh(value)) / 2.0f;
 }
-#endif
+
 
 void Network::softmax(const std::vector<float>& input,
                       std::vector<float>& output,
@@ -880,75 +824,101 @@ Network::Netresult Network::get_scored_moves_internal(
     const GameState* state, NNPlanes & planes, int rotation) {
     assert(rotation >= 0 && rotation <= 7);
     assert(INPUT_CHANNELS == planes.size());
-    constexpr int width = 19;
-    constexpr int height = 19;
-    const auto convolve_channels = conv_pol_w.size() / conv_pol_b.size();
-    std::vector<net_t> input_data;
-    std::vector<net_t> output_data(convolve_channels * width * height);
-    std::vector<float> policy_data(OUTPUTS_POLICY * width * height);
-    std::vector<float> value_data(OUTPUTS_VALUE * width * height);
-    std::vector<float> policy_out((width * height) + 1);
-    std::vector<float> softmax_data((width * height) + 1);
-    std::vector<float> winrate_data(256);
-    std::vector<float> winrate_out(1);
-    // Data layout is input_data[(c * height + h) * width + w]
-    input_data.reserve(INPUT_CHANNELS * width * height);
-    for (int c = 0; c < INPUT_CHANNELS; ++c) {
-        for (int h = 0; h < height; ++h) {
-            for (int w = 0; w < width; ++w) {
-                auto rot_idx = rotate_nn_idx_table[rotation][h * 19 + w];
-                input_data.emplace_back(net_t(planes[c][rot_idx]));
-            }
-        }
-    }
-#ifdef USE_OPENCL
-    opencl.forward(input_data, policy_data, value_data);
-#elif defined(USE_BLAS) && !defined(USE_OPENCL)
-    forward_cpu(input_data, policy_data, value_data);
-#endif
+    std::vector<std::uint32_t> input_data(PACKED_INPUT_SIZE);
+    std::vector<float> policy_data(POTENTIAL_MOVES);
+    std::vector<float> value_data(1);
+    // The backend expands the planes and applies the rotation.
+    pack_input(planes, rotation, input_data.data());
+    forward_pipe->forward_packed(1, input_data, policy_data, value_data);
 #ifdef USE_OPENCL_SELFCHECK
-    // Both implementations are available, self-check the OpenCL driver by
-    // running both with a probability of 1/2000.
-    if (Random::get_Rng().randfix<SELFCHECK_PROBABILITY>() == 0) {
-        auto cpu_policy_data = std::vector<float>(policy_data.size());
-        auto cpu_value_data = std::vector<float>(value_data.size());
-        forward_cpu(input_data, cpu_policy_data, cpu_value_data);
-        compare_net_outputs(policy_data, cpu_policy_data);
-        compare_net_outputs(value_data, cpu_value_data);
-    }
+    maybe_selfcheck(input_data.data(), policy_data, value_data);
 #endif
 
-    // Get the moves
-    batchnorm<361>(OUTPUTS_POLICY, policy_data, bn_pol_w1.data(), bn_pol_w2.data());
-    innerproduct<OUTPUTS_POLICY*361, 362>(policy_data, ip_pol_w, ip_pol_b, policy_out);
-    softmax(policy_out, softmax_data, cfg_softmax_temp);
-    std::vector<float>& outputs = softmax_data;
+    std::vector<scored_node> result;
+    policy_head(state, policy_data, rotate_nn_idx_table[rotation], result);
+    const auto winrate_sig = value_head(value_data[0]);
 
-    // Now get the score
-    batchnorm<361>(OUTPUTS_VALUE, value_data, bn_val_w1.data(), bn_val_w2.data());
-    innerproduct<361, 256>(value_data, ip1_val_w, ip1_val_b, winrate_data);
-    innerproduct<256, 1>(winrate_data, ip2_val_w, ip2_val_b, winrate_out);
+    return std::make_pair(result, winrate_sig);
+}
 
-    // Sigmoid
-    auto winrate_sig = (1.0f + std::tanh(winrate_out[0])) / 2.0f;
+std::vector<Network::Netresult> Network::get_scored_moves_batch(
+    const std::vector<const GameState*>& states) {
+    auto eval = start_batch(states);
+    return finish_batch(*eval);
+}
 
-    std::vector<scored_node> result;
-    for (auto idx = size_t{0}; idx < outputs.size(); idx++) {
-        if (idx < 19*19) {
-            auto val = outputs[idx];
-            auto rot_idx = rotate_nn_idx_table[rotation][idx];
-            auto x = rot_idx % 19;
-            auto y = rot_idx / 19;
-            auto rot_vtx = state->board.get_vertex(x, y);
-            if (state->board.get_square(rot_vtx) == FastBoard::EMPTY) {
-                result.emplace_back(val, rot_vtx);
-            }
-        } else {
-            result.emplace_back(outputs[idx], FastBoard::PASS);
+std::unique_ptr<Network::BatchEval> Network::start_batch(
+    const std::vector<const GameState*>& states) {
+    auto eval = std::make_unique<BatchEval>();
+    eval->states = states;
+    eval->results.resize(states.size());
+
+    // Positions to evaluate, the others come from the cache.
+    auto misses = std::vector<size_t>{};
+    for (auto i = size_t{0}; i < states.size(); i++) {
+        const auto state = states[i];
+        if (state->board.get_boardsize() != 19) {
+            continue;
+        }
+        if (!NNCache::get_NNCache().lookup(state->board.get_hash(),
+                                           eval->results[i])) {
+            misses.emplace_back(i);
         }
     }
 
-    return std::make_pair(result, winrate_sig);
+    const auto max_batch_size = forward_pipe->get_max_batch_size();
+    for (auto first = size_t{0}; first < misses.size();
+         first += max_batch_size) {
+        const auto batch_size =
+            std::min(max_batch_size, misses.size() - first);
+        eval->chunks.emplace_back();
+        auto& chunk = eval->chunks.back();
+        chunk.positions.assign(begin(misses) + first,
+                               begin(misses) + first + batch_size);
+        chunk.rotations.resize(batch_size);
+        chunk.input_data.resize(batch_size * PACKED_INPUT_SIZE);
+        chunk.policy_data.resize(batch_size * POTENTIAL_MOVES);
+        chunk.value_data.resize(batch_size);
+        for (auto j = size_t{0}; j < batch_size; j++) {
+            NNPlanes planes;
+            gather_features(states[chunk.positions[j]], planes);
+            chunk.rotations[j] = Random::get_Rng().randfix<8>();
+            pack_input(planes, chunk.rotations[j],
+                       chunk.input_data.data() + j * PACKED_INPUT_SIZE);
+        }
+        chunk.done = forward_pipe->forward_packed_async(
+            batch_size, chunk.input_data,
+            chunk.policy_data, chunk.value_data);
+    }
+
+    return eval;
+}
+
+std::vector<Network::Netresult> Network::finish_batch(BatchEval& eval) {
+    for (auto& chunk : eval.chunks) {
+        chunk.done.get();
+        for (auto j = size_t{0}; j < chunk.positions.size(); j++) {
+            const auto i = chunk.positions[j];
+            auto policy = std::vector<float>(
+                begin(chunk.policy_data) + j * POTENTIAL_MOVES,
+                begin(chunk.policy_data) + (j + 1) * POTENTIAL_MOVES);
+            auto value = std::vector<float>{chunk.value_data[j]};
+#ifdef USE_OPENCL_SELFCHECK
+            maybe_selfcheck(chunk.input_data.data() + j * PACKED_INPUT_SIZE,
+                            policy, value);
+#endif
+            auto& result = eval.results[i];
+            policy_head(eval.states[i], policy,
+                        rotate_nn_idx_table[chunk.rotations[j]],
+                        result.first);
+            result.second = value_head(value[0]);
+            NNCache::get_NNCache().insert(eval.states[i]->board.get_hash(),
+                                          result);
+        }
+    }
+    eval.chunks.clear();
+
+    return std::move(eval.results);
 }
 
 void Network::show_heatmap(const FastState * state, Netresult& result, bool topmoves) {
@@ -1050,6 +1020,51 @@ void Network::gather_features(const GameState* state, NNPlanes & planes) {
     }
 }
 
+void Network::pack_input(const NNPlanes& planes, const int symmetry,
+                         std::uint32_t* const packed) {
+    assert(symmetry >= 0 && symmetry < 8);
+    constexpr auto history_planes = 2 * INPUT_MOVES;
+    std::fill(packed, packed + PACKED_INPUT_SIZE, 0);
+    for (auto p = 0; p < history_planes; p++) {
+        const auto& plane = planes[p];
+        if (plane.none()) {
+            continue;
+        }
+        const auto words = packed + p * PACKED_PLANE_WORDS;
+        for (auto i = size_t{0}; i < plane.size(); i++) {
+            if (plane[i]) {
+                words[i / 32] |= std::uint32_t{1} << (i % 32);
+            }
+        }
+    }
+    packed[history_planes * PACKED_PLANE_WORDS] =
+        planes[history_planes + 1][0] ? 1 : 0;
+    packed[history_planes * PACKED_PLANE_WORDS + 1] = symmetry;
+}
+
+void Network::unpack_input(const std::uint32_t* const packed,
+                           float* const input) {
+    // Data layout is input[(c * height + h) * width + w]
+    constexpr auto board_squares = 19 * 19;
+    constexpr auto history_planes = 2 * INPUT_MOVES;
+    const auto white_to_move = packed[history_planes * PACKED_PLANE_WORDS];
+    const auto symmetry = packed[history_planes * PACKED_PLANE_WORDS + 1];
+    assert(symmetry < 8);
+    const auto& rotation = rotate_nn_idx_table[symmetry];
+    for (auto p = 0; p < history_planes; p++) {
+        const auto words = packed + p * PACKED_PLANE_WORDS;
+        for (auto v = 0; v < board_squares; v++) {
+            const auto idx = rotation[v];
+            const auto bit = (words[idx / 32] >> (idx % 32)) & 1;
+            input[p * board_squares + v] = float(bit);
+        }
+    }
+    std::fill_n(input + history_planes * board_squares, board_squares,
+                white_to_move ? 0.0f : 1.0f);
+    std::fill_n(input + (history_planes + 1) * board_squares, board_squares,
+                white_to_move ? 1.0f : 0.0f);
+}
+
 int Network::rotate_nn_idx(const int vertex, int symmetry) {
     assert(vertex >= 0 && vertex < 19*19);
     assert(symmetry >= 0 && symmetry < 8);
@@ -23,6 +23,8 @@
 
 #include <array>
 #include <bitset>
+#include <cstdint>
+#include <future>
 #include <memory>
 #include <string>
 #include <utility>
@@ -46,12 +48,32 @@ public:
                                       Ensemble ensemble,
                                       int rotation = -1,
                                       bool skip_cache = false);
+    // Several positions at once, with a random rotation each, so the
+    // backend can evaluate them together.
+    static std::vector<Netresult> get_scored_moves_batch(
+        const std::vector<const GameState*>& states);
+
+    // get_scored_moves_batch in two halves, the caller can do other
+    // work while the backend evaluates. The states must stay alive
+    // until finish_batch, which is called exactly once.
+    struct BatchEval;
+    static std::unique_ptr<BatchEval> start_batch(
+        const std::vector<const GameState*>& states);
+    static std::vector<Netresult> finish_batch(BatchEval& eval);
     // File format version
     static constexpr auto FORMAT_VERSION = 1;
     static constexpr auto INPUT_MOVES = 8;
     static constexpr auto INPUT_CHANNELS = 2 * INPUT_MOVES + 2;
     static constexpr auto OUTPUTS_POLICY = 2;
     static constexpr auto OUTPUTS_VALUE = 1;
+    static constexpr auto POTENTIAL_MOVES = 19 * 19 + 1;
+    static constexpr auto VALUE_HIDDEN = 256;
+
+    // Packed input of a position: the history planes as bits, then
+    // the side to move (0 black, 1 white) and the symmetry to apply.
+    static constexpr auto PACKED_PLANE_WORDS = (19 * 19 + 31) / 32;
+    static constexpr auto PACKED_INPUT_SIZE =
+        2 * INPUT_MOVES * PACKED_PLANE_WORDS + 2;
 
     // Winograd filter transformation changes 3x3 filters to 4x4
     static constexpr auto WINOGRAD_ALPHA = 4;
@@ -66,43 +88,44 @@ public:
                         float temperature = 1.0f);
 
     static void gather_features(const GameState* state, NNPlanes& planes);
-private:
-    static std::pair<int, int> load_v1_network(std::ifstream& wtfile);
-    static std::pair<int, int> load_network_file(std::string filename);
-    static void process_bn_var(std::vector<float>& weights,
-                               const float epsilon=1e-5f);
+    static void pack_input(const NNPlanes& planes, const int symmetry,
+                           std::uint32_t* const packed);
+    static void unpack_input(const std::uint32_t* const packed,
+                             float* const input);
 
     static std::vector<float> winograd_transform_f(const std::vector<float>& f,
         const int outputs, const int channels);
     static std::vector<float> zeropad_U(const std::vector<float>& U,
         const int outputs, const int channels,
         const int outputs_pad, const int channels_pad);
-    static void winograd_transform_in(const std::vector<float>& in,
-                                      std::vector<float>& V,
-                                      const int C);
-    static void winograd_transform_out(const std::vector<float>& M,
-                                       std::vector<float>& Y,
-                                       const int K);
-    static void winograd_convolve3(const int outputs,
-                                   const std::vector<float>& input,
-                                   const std::vector<float>& U,
-                                   std::vector<float>& V,
-                                   std::vector<float>& M,
-                                   std::vector<float>& output);
-    static void winograd_sgemm(const std::vector<float>& U,
-                               std::vector<float>& V,
-                               std::vector<float>& M, const int C, const int K);
+    struct BatchEval {
+        // One call to the backend, at most its maximum batch size
+        struct Chunk {
+            // Index in states of every position, and its rotation
+            std::vector<size_t> positions;
+            std::vector<int> rotations;
+            std::vector<std::uint32_t> input_data;
+            std::vector<float> policy_data;
+            std::vector<float> value_data;
+            std::future<void> done;
+        };
+        std::vector<const GameState*> states;
+        // Filled in from the cache at the start
+        std::vector<Netresult> results;
+        std::vector<Chunk> chunks;
+    };
+
+private:
+    static std::pair<int, int> load_v1_network(std::ifstream& wtfile);
+    static std::pair<int, int> load_network_file(std::string filename);
+    static void process_bn_var(std::vector<float>& weights,
+                               const float epsilon=1e-5f);
+
     static int rotate_nn_idx(const int vertex, int symmetry);
     static void fill_input_plane_pair(
       const FullBoard& board, BoardPlane& black, BoardPlane& white);
     static Netresult get_scored_moves_internal(
       const GameState* state, NNPlanes & planes, int rotation);
-#if defined(USE_BLAS)
-    static void forward_cpu(std::vector<float>& input,
-                            std::vector<float>& output_pol,
-                            std::vector<float>& output_val);
-
-#endif
 };
 
 #endif
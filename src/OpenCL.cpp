@@ -23,17 +23,23 @@
 
 #include <cassert>
 #include <algorithm>
+#include <atomic>
 #include <boost/algorithm/string.hpp>
 #include <boost/format.hpp>
 #include <iterator>
 #include <limits>
 #include <stdexcept>
 
+#include <cstdint>
 #include <cstdio>
+#include <fstream>
+#include <future>
 #include <iostream>
 #include <memory>
+#include <random>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 
 #include "Network.h"
 #include "GTP.h"
@@ -42,13 +48,23 @@
 
 using namespace Utils;
 
+const auto BINARY_FILE_LOCAL = std::string("leelaz_opencl_binary");
+
 static std::string cl_args =
     "-cl-mad-enable -cl-fast-relaxed-math -cl-no-signed-zeros -cl-denorms-are-zero";
 
+// With USE_HALF, weights and activations are stored as half and
+// converted to float for the arithmetic.
 static std::string sourceCode_config = R"(
+#ifdef USE_HALF
+    typedef half net_t;
+    #define vload_net_t(offset,p) vload_half(offset,p)
+    #define vstore_net_t(data,offset,p) vstore_half(data,offset,p)
+#else
     typedef float net_t;
     #define vload_net_t(offset,p) ((p)[(offset)])
     #define vstore_net_t(data,offset,p) (((p)[(offset)])=(data))
+#endif
 )";
 
 static std::string sourceCode_convolve1 = R"(
@@ -60,10 +76,10 @@ static std::string sourceCode_convolve1 = R"(
                    __global const net_t * weights,
                    __local float * channel_buff,
                    __local float * row_buff) {
-        // cl::NDRange global(channels, outputs, row);
+        // cl::NDRange global(channels, outputs, batch * row);
         const int c   = get_global_id(0);  // channel
         const int o   = get_global_id(1);  // output
-        const int row = get_global_id(2);  // row
+        const int row_batch = get_global_id(2);  // row
         const int channels = get_global_size(0);
         const int outputs  = get_global_size(1);
         // cl::NDRange local(2, (1->32), 1);
@@ -80,6 +96,10 @@ static std::string sourceCode_convolve1 = R"(
         const int width = 19;
         const int height = 19;
         const int strip_size = width;
+        const int batch = row_batch / height;
+        const int row = row_batch % height;
+        in += batch * channels * height * width;
+        merge += batch * (channels >> chan_shift) * height * width * outputs;
         // Copy the input channels (strips) locally
         if (out_buff_size < 19 && ly == 0) {
             // strip-row
@@ -127,9 +147,10 @@ __kernel void merge(
                         __global const net_t * in,
                         __global net_t * out,
                         __private const int channels) {
-        // cl::NDRange global(outputs, 19*19);
+        // cl::NDRange global(outputs, 19*19, batch);
         const int gx = get_global_id(0);
         const int gy = get_global_id(1);
+        const int batch = get_global_id(2);
         const int output = gx;
         const int b = gy;
         const int outputs = get_global_size(0);
@@ -137,6 +158,8 @@ __kernel void merge(
         const int height = 19;
         const int boardsize = width * height;
         const int o = output;
+        in += batch * channels * boardsize * outputs;
+        out += batch * outputs * boardsize;
         float sum = 0;
         for (int c = 0; c < channels; c++) {
             sum += vload_net_t((c * boardsize + b) * outputs + o, in);
@@ -145,8 +168,104 @@ __kernel void merge(
     }
 )";
 
+static std::string sourceCode_input = R"(
+    // Expands positions packed by Network::pack_input to input planes
+    // of zeros and ones, rotated like Network::rotate_nn_idx does.
+    __kernel void expand_input(
+                   __global const uint * packed,
+                   __global net_t * out,
+                   __private const int history_planes,
+                   __private const int plane_words) {
+        // cl::NDRange global(19 * 19, batch);
+        const int v = get_global_id(0);
+        const int batch = get_global_id(1);
+        const int boardsize = 19 * 19;
+        packed += batch * (history_planes * plane_words + 2);
+        out += batch * (history_planes + 2) * boardsize;
+
+        const uint white_to_move = packed[history_planes * plane_words];
+        int symmetry = packed[history_planes * plane_words + 1];
+        int x = v % 19;
+        int y = v / 19;
+        if (symmetry >= 4) {
+            const int tmp = x;
+            x = y;
+            y = tmp;
+            symmetry -= 4;
+        }
+        if (symmetry & 1) {
+            y = 19 - y - 1;
+        }
+        if (symmetry & 2) {
+            x = 19 - x - 1;
+        }
+        const int idx = y * 19 + x;
+
+        for (int p = 0; p < history_planes; p++) {
+            const uint word = packed[p * plane_words + idx / 32];
+            vstore_net_t((float)((word >> (idx % 32)) & 1),
+                         p * boardsize + v, out);
+        }
+        vstore_net_t(white_to_move ? 0.0f : 1.0f,
+                     history_planes * boardsize + v, out);
+        vstore_net_t(white_to_move ? 1.0f : 0.0f,
+                     (history_planes + 1) * boardsize + v, out);
+    }
+)";
+
+static std::string sourceCode_heads = R"(
+    // Batchnorm and ReLU of the head convolution planes, followed by
+    // a fully connected layer. Weights are stored [inputs][outputs],
+    // so that neighbouring work items read neighbouring weights.
+    __kernel void head_fc(
+                   __global const net_t * in,
+                   __global float * out,
+                   __global const net_t * means,
+                   __global const net_t * stddivs,
+                   __global const net_t * weights,
+                   __global const net_t * biases,
+                   __private const int channels,
+                   __private const int relu) {
+        // cl::NDRange global(outputs, batch);
+        const int o = get_global_id(0);
+        const int batch = get_global_id(1);
+        const int outputs = get_global_size(0);
+        const int boardsize = 19 * 19;
+        in += batch * channels * boardsize;
+        float sum = vload_net_t(o, biases);
+        for (int c = 0; c < channels; c++) {
+            const float mean = vload_net_t(c, means);
+            const float scale_stddiv = vload_net_t(c, stddivs);
+            for (int b = 0; b < boardsize; b++) {
+                const int i = c * boardsize + b;
+                const float val =
+                    fmax(scale_stddiv * (vload_net_t(i, in) - mean), 0.0f);
+                sum += val * vload_net_t(i * outputs + o, weights);
+            }
+        }
+        out[batch * outputs + o] = relu ? fmax(sum, 0.0f) : sum;
+    }
+
+    // Final inner product of the value head, one output per position.
+    __kernel void value_out(
+                   __global const float * in,
+                   __global float * out,
+                   __global const net_t * weights,
+                   __global const net_t * biases,
+                   __private const int inputs) {
+        // cl::NDRange global(batch);
+        const int batch = get_global_id(0);
+        in += batch * inputs;
+        float sum = vload_net_t(0, biases);
+        for (int i = 0; i < inputs; i++) {
+            sum += in[i] * vload_net_t(i, weights);
+        }
+        out[batch] = sum;
+    }
+)";
+
 static std::string sourceCode_convolve3 = R"(
-void __in_transform_eq(float x[4][4], __global float *V, int offset, int CPpad) {
+void __in_transform_eq(float x[4][4], __global net_t *V, int offset, int CPpad) {
     float T1[4][4];
 
     T1[0][0] = x[0][0] - x[2][0];
@@ -166,25 +285,25 @@ void __in_transform_eq(float x[4][4], __global float *V, int offset, int CPpad)
     T1[3][2] = x[1][2] - x[3][2];
     T1[3][3] = x[1][3] - x[3][3];
 
-    V[(0*4 + 0)*CPpad + offset] = T1[0][0] - T1[0][2];
-    V[(0*4 + 1)*CPpad + offset] = T1[0][1] + T1[0][2];
-    V[(0*4 + 2)*CPpad + offset] = T1[0][2] - T1[0][1];
-    V[(0*4 + 3)*CPpad + offset] = T1[0][1] - T1[0][3];
-    V[(1*4 + 0)*CPpad + offset] = T1[1][0] - T1[1][2];
-    V[(1*4 + 1)*CPpad + offset] = T1[1][1] + T1[1][2];
-    V[(1*4 + 2)*CPpad + offset] = T1[1][2] - T1[1][1];
-    V[(1*4 + 3)*CPpad + offset] = T1[1][1] - T1[1][3];
-    V[(2*4 + 0)*CPpad + offset] = T1[2][0] - T1[2][2];
-    V[(2*4 + 1)*CPpad + offset] = T1[2][1] + T1[2][2];
-    V[(2*4 + 2)*CPpad + offset] = T1[2][2] - T1[2][1];
-    V[(2*4 + 3)*CPpad + offset] = T1[2][1] - T1[2][3];
-    V[(3*4 + 0)*CPpad + offset] = T1[3][0] - T1[3][2];
-    V[(3*4 + 1)*CPpad + offset] = T1[3][1] + T1[3][2];
-    V[(3*4 + 2)*CPpad + offset] = T1[3][2] - T1[3][1];
-    V[(3*4 + 3)*CPpad + offset] = T1[3][1] - T1[3][3];
+    vstore_net_t(T1[0][0] - T1[0][2], (0*4 + 0)*CPpad + offset, V);
+    vstore_net_t(T1[0][1] + T1[0][2], (0*4 + 1)*CPpad + offset, V);
+    vstore_net_t(T1[0][2] - T1[0][1], (0*4 + 2)*CPpad + offset, V);
+    vstore_net_t(T1[0][1] - T1[0][3], (0*4 + 3)*CPpad + offset, V);
+    vstore_net_t(T1[1][0] - T1[1][2], (1*4 + 0)*CPpad + offset, V);
+    vstore_net_t(T1[1][1] + T1[1][2], (1*4 + 1)*CPpad + offset, V);
+    vstore_net_t(T1[1][2] - T1[1][1], (1*4 + 2)*CPpad + offset, V);
+    vstore_net_t(T1[1][1] - T1[1][3], (1*4 + 3)*CPpad + offset, V);
+    vstore_net_t(T1[2][0] - T1[2][2], (2*4 + 0)*CPpad + offset, V);
+    vstore_net_t(T1[2][1] + T1[2][2], (2*4 + 1)*CPpad + offset, V);
+    vstore_net_t(T1[2][2] - T1[2][1], (2*4 + 2)*CPpad + offset, V);
+    vstore_net_t(T1[2][1] - T1[2][3], (2*4 + 3)*CPpad + offset, V);
+    vstore_net_t(T1[3][0] - T1[3][2], (3*4 + 0)*CPpad + offset, V);
+    vstore_net_t(T1[3][1] + T1[3][2], (3*4 + 1)*CPpad + offset, V);
+    vstore_net_t(T1[3][2] - T1[3][1], (3*4 + 2)*CPpad + offset, V);
+    vstore_net_t(T1[3][1] - T1[3][3], (3*4 + 3)*CPpad + offset, V);
 }
 
-__kernel void in_transform(__global net_t *in, __global float *V,
+__kernel void in_transform(__global net_t *in, __global net_t *V,
                            const int C, const int Cpad,
                            const int Ppad) {
     const int W = 19;
@@ -196,7 +315,8 @@ __kernel void in_transform(__global net_t *in, __global float *V,
 
     const int block = get_global_id(0);
     const int ch = get_global_id(1);
-    const int chT = ch*(T);
+    const int batch = get_global_id(2);
+    const int chT = (batch*C + ch)*(T);
 
     const int block_x = block % WTILES;
     const int block_y = block / WTILES;
@@ -220,22 +340,24 @@ __kernel void in_transform(__global net_t *in, __global float *V,
             }
         }
 
-        const int offset = ch*Ppad + block;
+        // The tiles of all positions form the N dimension of the SGEMM
+        const int offset = ch*Ppad + batch*P + block;
         __in_transform_eq(x, V, offset, CPpad);
     }
 }
 
-void __out_transform_eq(__global float *M, float o[4], int Kpad, int Ppad, int block_x, int block_y)
+void __out_transform_eq(__global net_t *M, float o[4], int Kpad, int Ppad, int block_x, int block_y, int batch)
 {
     const int W = 19;
     const int H = 19;
     const int WTILES = (W + 1) / 2;
-    const int b = block_y * WTILES + block_x;
+    const int P = WTILES * WTILES;
+    const int b = batch * P + block_y * WTILES + block_x;
     const int KPpad = Kpad * Ppad;
     const int k = get_global_id(0);
     float temp_m[16];
     for (int xn = 0, xnKPpad = b*Kpad + k; xn < 16; xn++, xnKPpad += KPpad) {
-        temp_m[xn] = M[xnKPpad];
+        temp_m[xn] = vload_net_t(xnKPpad, M);
     }
 
     o[0] = temp_m[0*4 + 0] + temp_m[0*4 + 1] + temp_m[0*4 + 2] +
@@ -255,7 +377,7 @@ void __out_transform_eq(__global float *M, float o[4], int Kpad, int Ppad, int b
            temp_m[3*4 + 1] + temp_m[3*4 + 2] + temp_m[3*4 + 3];
 }
 
-__kernel void out_transform_fused_bn(__global float *M,
+__kernel void out_transform_fused_bn(__global net_t *M,
                                      __global net_t *Y,
                                      const int K,
                                      const int Kpad, const int Ppad,
@@ -269,6 +391,7 @@ __kernel void out_transform_fused_bn(__global float *M,
 
     int k = get_global_id(0);
     int block = get_global_id(1);
+    int batch = get_global_id(2);
 
     const int block_x = block % WTILES;
     const int block_y = block / WTILES;
@@ -277,9 +400,9 @@ __kernel void out_transform_fused_bn(__global float *M,
     int y = 2*block_y;
     int a_ind = (y)*W + (x);
     if (k < K && block < P) {
-        const int kHW = k * W * H;
+        const int kHW = (batch * K + k) * W * H;
         float o[4];
-        __out_transform_eq(M, o, Kpad, Ppad, block_x, block_y);
+        __out_transform_eq(M, o, Kpad, Ppad, block_x, block_y, batch);
 
         const float mean = vload_net_t(k, means);
         const float scale_stddiv = vload_net_t(k, stddivs);
@@ -302,7 +425,7 @@ __kernel void out_transform_fused_bn(__global float *M,
 }
 
 __kernel void out_transform_fused_bn_in(
-                                     __global float *M,
+                                     __global net_t *M,
                                      __global net_t *Y,
                                      __global net_t *V,
                                      const int K,
@@ -321,7 +444,7 @@ __kernel void out_transform_fused_bn_in(
     const int k = get_global_id(0);
     const int kg = get_local_id(0);
     const int block = get_global_id(1);
-    const int chT = k*(T);
+    const int batch = get_global_id(2);
 
     const int block_x = block % WTILES;
     const int block_y = block / WTILES;
@@ -338,10 +461,10 @@ __kernel void out_transform_fused_bn_in(
     if (k < K && block < P) {
         const int a[4] = {a_ind, a_ind+1, a_ind+W, a_ind+W+1};
         const bool pred[4] = { 1, x+1 < W, y+1 < H, x+1 < W & y+1 < H};
-        const int kHW = k * W * H;
+        const int kHW = (batch * K + k) * W * H;
 
         float o[4];
-        __out_transform_eq(M, o, Kpad, Ppad, block_x, block_y);
+        __out_transform_eq(M, o, Kpad, Ppad, block_x, block_y, batch);
 
         const float mean = vload_net_t(k, means);
         const float scale_stddiv = vload_net_t(k, stddivs);
@@ -379,7 +502,7 @@ __kernel void out_transform_fused_bn_in(
             }
         }
 
-        const int offset = k*Ppad + block;
+        const int offset = k*Ppad + batch*P + block;
         __in_transform_eq(xx, V, offset, CPpad);
     }
 }
@@ -394,27 +517,42 @@ const std::string sourceCode_sgemm =
     #include "clblast_level3/xgemm_batched.opencl"
 ;
 
-thread_local ThreadData opencl_thread_data;
+// Per thread data of every device, by OpenCL::m_id. Ids are never
+// reused, so data of a device that went away can't be picked up again.
+thread_local std::unordered_map<size_t, ThreadData> opencl_thread_data;
+
+static std::atomic<size_t> next_opencl_id{0};
 
-void OpenCL::ensure_thread_initialized() {
-    if (!opencl_thread_data.m_is_initialized) {
+OpenCL::OpenCL() : m_id(next_opencl_id++) {
+}
+
+ThreadData& OpenCL::ensure_thread_initialized() {
+    auto& thread_data = opencl_thread_data[m_id];
+    if (!thread_data.m_is_initialized) {
         // Make kernels
-        opencl_thread_data.m_convolve1_kernel =
+        thread_data.m_convolve1_kernel =
             cl::Kernel(m_program, "convolve1");
-        opencl_thread_data.m_merge_kernel =
+        thread_data.m_merge_kernel =
             cl::Kernel(m_program, "merge");
-        opencl_thread_data.m_in_transform_kernel =
+        thread_data.m_in_transform_kernel =
             cl::Kernel(m_program, "in_transform");
-        opencl_thread_data.m_sgemm_kernel =
+        thread_data.m_sgemm_kernel =
             cl::Kernel(m_program, "XgemmBatched");
-        opencl_thread_data.m_out_transform_bn_kernel =
+        thread_data.m_out_transform_bn_kernel =
             cl::Kernel(m_program, "out_transform_fused_bn");
-        opencl_thread_data.m_out_transform_bn_in_kernel =
+        thread_data.m_out_transform_bn_in_kernel =
             cl::Kernel(m_program, "out_transform_fused_bn_in");
-        opencl_thread_data.m_commandqueue =
+        thread_data.m_expand_input_kernel =
+            cl::Kernel(m_program, "expand_input");
+        thread_data.m_head_fc_kernel =
+            cl::Kernel(m_program, "head_fc");
+        thread_data.m_value_out_kernel =
+            cl::Kernel(m_program, "value_out");
+        thread_data.m_commandqueue =
             cl::CommandQueue(m_context, m_device);
-        opencl_thread_data.m_is_initialized = true;
+        thread_data.m_is_initialized = true;
     }
+    return thread_data;
 }
 
 void OpenCL_Network::add_weights(size_t layer,
@@ -424,36 +562,205 @@ void OpenCL_Network::add_weights(size_t layer,
         m_layers.push_back(Layer());
     }
 
-    auto converted_weights = std::vector<net_t>();
-    for(auto i = size_t{0}; i < size; i++) {
-        converted_weights.emplace_back(weights[i]);
+    auto weightSize = size * m_opencl.storage_size();
+    if (m_opencl.m_half) {
+        auto converted_weights = std::vector<std::uint16_t>();
+        for (auto i = size_t{0}; i < size; i++) {
+            converted_weights.emplace_back(float_to_half(weights[i]));
+        }
+        m_layers.back().weights.emplace_back(
+            m_opencl.m_context,
+            CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY,
+            weightSize,
+            converted_weights.data());
+    } else {
+        m_layers.back().weights.emplace_back(
+            m_opencl.m_context,
+            CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY,
+            weightSize,
+            const_cast<float*>(weights));
     }
+}
 
-    auto weightSize = size * sizeof(decltype(converted_weights)::value_type);
-    m_layers.back().weights.emplace_back(
-        m_opencl.m_context,
-        CL_MEM_COPY_HOST_PTR | CL_MEM_READ_ONLY,
-        weightSize,
-        const_cast<net_t*>(converted_weights.data()));
+void OpenCL_Network::push_policy_head(const std::vector<float>& means,
+                                      const std::vector<float>& stddivs,
+                                      const std::vector<float>& ip_w,
+                                      const std::vector<float>& ip_b) {
+    const auto outputs = ip_b.size();
+    const auto inputs = ip_w.size() / outputs;
+    auto ip_w_t = std::vector<float>(ip_w.size());
+    for (auto o = size_t{0}; o < outputs; o++) {
+        for (auto i = size_t{0}; i < inputs; i++) {
+            ip_w_t[i * outputs + o] = ip_w[o * inputs + i];
+        }
+    }
+
+    size_t layer = get_layer_count();
+    push_weights(layer, means);
+    push_weights(layer, stddivs);
+    push_weights(layer, ip_w_t);
+    push_weights(layer, ip_b);
+    m_layers[layer].is_policy_head = true;
+    m_layers[layer].channels = means.size();
+    m_layers[layer].outputs = outputs;
+    m_policy_outputs = outputs;
+}
+
+void OpenCL_Network::push_value_head(const std::vector<float>& means,
+                                     const std::vector<float>& stddivs,
+                                     const std::vector<float>& ip1_w,
+                                     const std::vector<float>& ip1_b,
+                                     const std::vector<float>& ip2_w,
+                                     const std::vector<float>& ip2_b) {
+    const auto hidden = ip1_b.size();
+    const auto inputs = ip1_w.size() / hidden;
+    assert(ip2_w.size() == hidden && ip2_b.size() == 1);
+    auto ip1_w_t = std::vector<float>(ip1_w.size());
+    for (auto o = size_t{0}; o < hidden; o++) {
+        for (auto i = size_t{0}; i < inputs; i++) {
+            ip1_w_t[i * hidden + o] = ip1_w[o * inputs + i];
+        }
+    }
+
+    size_t layer = get_layer_count();
+    push_weights(layer, means);
+    push_weights(layer, stddivs);
+    push_weights(layer, ip1_w_t);
+    push_weights(layer, ip1_b);
+    push_weights(layer, ip2_w);
+    push_weights(layer, ip2_b);
+    m_layers[layer].is_value_head = true;
+    m_layers[layer].channels = means.size();
+    m_layers[layer].outputs = hidden;
+    m_value_hidden = hidden;
+}
+
+struct ForwardCompletion {
+    std::promise<void> promise;
+    std::function<void()> finished;
+};
+
+// Called by the OpenCL runtime when the last command of an evaluation
+// finished, or failed.
+static void CL_CALLBACK forward_complete(cl_event event, cl_int status,
+                                         void* data) {
+    (void)event;
+    auto completion = std::unique_ptr<ForwardCompletion>(
+        static_cast<ForwardCompletion*>(data));
+    if (completion->finished) {
+        completion->finished();
+    }
+    if (status == CL_COMPLETE) {
+        completion->promise.set_value();
+    } else {
+        completion->promise.set_exception(std::make_exception_ptr(
+            std::runtime_error("OpenCL evaluation failed.")));
+    }
 }
 
 void OpenCL_Network::forward(const std::vector<net_t>& input,
                              std::vector<net_t>& output_pol,
-                             std::vector<net_t>& output_val) {
+                             std::vector<net_t>& output_val,
+                             const size_t batch_size) {
+    forward_async(input, output_pol, output_val, batch_size).get();
+}
+
+void OpenCL_Network::forward(const std::vector<std::uint32_t>& input,
+                             std::vector<net_t>& output_pol,
+                             std::vector<net_t>& output_val,
+                             const size_t batch_size) {
+    forward_async(input, output_pol, output_val, batch_size).get();
+}
+
+std::future<void> OpenCL_Network::forward_async(
+    const std::vector<net_t>& input,
+    std::vector<net_t>& output_pol,
+    std::vector<net_t>& output_val,
+    const size_t batch_size,
+    std::function<void()> finished) {
+    assert(batch_size > 0 && batch_size <= m_opencl.m_batch_size);
+
+    auto& thread_data = m_opencl.ensure_thread_initialized();
+    ensure_buffers_allocated(thread_data);
+
+    cl::CommandQueue & queue = thread_data.m_commandqueue;
+    const auto inSize = m_opencl.storage_size() * input.size();
+    if (m_opencl.m_half) {
+        // Blocking, the conversion buffer is reused by the next call.
+        auto& half_input = thread_data.m_half_input;
+        half_input.resize(input.size());
+        std::transform(begin(input), end(input), begin(half_input),
+                       float_to_half);
+        queue.enqueueWriteBuffer(thread_data.m_inBuffer, CL_TRUE, 0, inSize,
+                                 half_input.data());
+    } else {
+        queue.enqueueWriteBuffer(thread_data.m_inBuffer, CL_FALSE, 0, inSize,
+                                 input.data());
+    }
+
+    return forward_layers(thread_data, output_pol, output_val, batch_size,
+                          std::move(finished));
+}
+
+std::future<void> OpenCL_Network::forward_async(
+    const std::vector<std::uint32_t>& input,
+    std::vector<net_t>& output_pol,
+    std::vector<net_t>& output_val,
+    const size_t batch_size,
+    std::function<void()> finished) {
+    constexpr auto history_planes = 2 * Network::INPUT_MOVES;
+    assert(batch_size > 0 && batch_size <= m_opencl.m_batch_size);
+    assert(input.size() == batch_size * Network::PACKED_INPUT_SIZE);
+
+    auto& thread_data = m_opencl.ensure_thread_initialized();
+    ensure_buffers_allocated(thread_data);
+
+    // Only the bits cross the bus, the planes are built on the device.
+    cl::CommandQueue & queue = thread_data.m_commandqueue;
+    queue.enqueueWriteBuffer(thread_data.m_packedBuffer, CL_FALSE, 0,
+                             input.size() * sizeof(std::uint32_t),
+                             input.data());
+
+    cl::Kernel & expand_input_kernel = thread_data.m_expand_input_kernel;
+    try {
+        expand_input_kernel.setArg(0, thread_data.m_packedBuffer);
+        expand_input_kernel.setArg(1, thread_data.m_inBuffer);
+        expand_input_kernel.setArg(2, history_planes);
+        expand_input_kernel.setArg(3, int(Network::PACKED_PLANE_WORDS));
+
+        queue.enqueueNDRangeKernel(expand_input_kernel, cl::NullRange,
+                                   cl::NDRange(19 * 19, batch_size));
+    } catch (const cl::Error &e) {
+        std::cerr << "Error in expand_input: " << e.what() << ": "
+            << e.err() << std::endl;
+        throw;
+    }
+
+    return forward_layers(thread_data, output_pol, output_val, batch_size,
+                          std::move(finished));
+}
+
+void OpenCL_Network::ensure_buffers_allocated(ThreadData& thread_data) {
     constexpr auto width = 19;
     constexpr auto height = 19;
     constexpr auto tiles = WINOGRAD_P;
-    constexpr auto one_plane = width * height * sizeof(net_t);
-    const auto finalSize_pol = m_layers[m_layers.size()-2].outputs * one_plane;
-    const auto finalSize_val = m_layers.back().outputs * one_plane;
+    const auto one_plane = width * height * m_opencl.storage_size();
+    const auto max_batch_size = m_opencl.m_batch_size;
 
-    m_opencl.ensure_thread_initialized();
-
-    if (!opencl_thread_data.m_buffers_allocated) {
+    if (!thread_data.m_buffers_allocated) {
         auto max_channels = unsigned{0};
+        auto head_channels_pol = unsigned{0};
+        auto head_channels_val = unsigned{0};
         for (const auto& layer : m_layers) {
-            max_channels = std::max(max_channels,
-                                    std::max(layer.channels, layer.outputs));
+            if (layer.is_policy_head) {
+                head_channels_pol = layer.channels;
+            } else if (layer.is_value_head) {
+                head_channels_val = layer.channels;
+            } else {
+                max_channels = std::max(max_channels,
+                                        std::max(layer.channels,
+                                                 layer.outputs));
+            }
         }
 
         const auto mwg = m_opencl.m_sgemm_tuners.mwg;
@@ -462,47 +769,81 @@ void OpenCL_Network::forward(const std::vector<net_t>& input,
         const auto vwn = m_opencl.m_sgemm_tuners.vwn;
 
         const auto m_ceil = ceilMultiple(ceilMultiple(max_channels, mwg), vwm);
-        const auto n_ceil = ceilMultiple(ceilMultiple(tiles, nwg), vwn);
+        const auto n_ceil =
+            ceilMultiple(ceilMultiple(tiles * max_batch_size, nwg), vwn);
 
         const auto alloc_inSize =
-            m_ceil * m_ceil *  max_channels * sizeof(net_t);
+            max_batch_size * max_channels * one_plane;
         const auto alloc_vm_size =
-            WINOGRAD_TILE * m_ceil * n_ceil * sizeof(net_t);
+            WINOGRAD_TILE * m_ceil * n_ceil * m_opencl.storage_size();
 
-        auto v_zeros = std::vector<float>(alloc_vm_size);
+        auto v_zeros = std::vector<char>(alloc_vm_size);
 
-        opencl_thread_data.m_inBuffer = cl::Buffer(
+        thread_data.m_inBuffer = cl::Buffer(
             m_opencl.m_context,
             CL_MEM_READ_WRITE, alloc_inSize);
-        opencl_thread_data.m_inBuffer2 = cl::Buffer(
+        thread_data.m_inBuffer2 = cl::Buffer(
             m_opencl.m_context,
             CL_MEM_READ_WRITE, alloc_inSize);
-        opencl_thread_data.m_VBuffer = cl::Buffer(
+        thread_data.m_packedBuffer = cl::Buffer(
+            m_opencl.m_context,
+            CL_MEM_READ_ONLY,
+            max_batch_size * Network::PACKED_INPUT_SIZE
+                * sizeof(std::uint32_t));
+        thread_data.m_VBuffer = cl::Buffer(
             m_opencl.m_context,
             CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS | CL_MEM_COPY_HOST_PTR,
             alloc_vm_size, v_zeros.data(), nullptr);
-        opencl_thread_data.m_MBuffer = cl::Buffer(
+        thread_data.m_MBuffer = cl::Buffer(
             m_opencl.m_context,
             CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, alloc_vm_size);
 
-        opencl_thread_data.m_pinnedOutBuffer_pol = cl::Buffer(
+        thread_data.m_headBuffer_pol = cl::Buffer(
+            m_opencl.m_context,
+            CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS,
+            max_batch_size * head_channels_pol * one_plane);
+        thread_data.m_headBuffer_val = cl::Buffer(
             m_opencl.m_context,
-            CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, finalSize_pol);
-        opencl_thread_data.m_pinnedOutBuffer_val = cl::Buffer(
+            CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS,
+            max_batch_size * head_channels_val * one_plane);
+        thread_data.m_hiddenBuffer_val = cl::Buffer(
             m_opencl.m_context,
-            CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, finalSize_val);
+            CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS,
+            max_batch_size * m_value_hidden * sizeof(float));
+
+        // Only the head outputs are read back
+        const auto alloc_pol_size =
+            max_batch_size * m_policy_outputs * sizeof(float);
+        const auto alloc_val_size = max_batch_size * sizeof(float);
 
-        opencl_thread_data.m_buffers_allocated = true;
+        thread_data.m_pinnedOutBuffer_pol = cl::Buffer(
+            m_opencl.m_context,
+            CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, alloc_pol_size);
+        thread_data.m_pinnedOutBuffer_val = cl::Buffer(
+            m_opencl.m_context,
+            CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, alloc_val_size);
+
+        thread_data.m_buffers_allocated = true;
     }
+}
+
+std::future<void> OpenCL_Network::forward_layers(
+    ThreadData& thread_data,
+    std::vector<net_t>& output_pol,
+    std::vector<net_t>& output_val,
+    const size_t batch_size,
+    std::function<void()> finished) {
+    const auto finalSize_pol = batch_size * m_policy_outputs * sizeof(float);
+    const auto finalSize_val = batch_size * sizeof(float);
 
-    cl::Buffer & inBuffer = opencl_thread_data.m_inBuffer;
-    cl::Buffer & inBuffer2 = opencl_thread_data.m_inBuffer2;
-    cl::Buffer & VBuffer = opencl_thread_data.m_VBuffer;
-    cl::Buffer & MBuffer = opencl_thread_data.m_MBuffer;
-    cl::CommandQueue & queue = opencl_thread_data.m_commandqueue;
+    assert(output_pol.size() * sizeof(net_t) == finalSize_pol);
+    assert(output_val.size() * sizeof(net_t) == finalSize_val);
 
-    const auto inSize = sizeof(net_t) * input.size();
-    queue.enqueueWriteBuffer(inBuffer, CL_FALSE, 0, inSize, input.data());
+    cl::Buffer & inBuffer = thread_data.m_inBuffer;
+    cl::Buffer & inBuffer2 = thread_data.m_inBuffer2;
+    cl::Buffer & VBuffer = thread_data.m_VBuffer;
+    cl::Buffer & MBuffer = thread_data.m_MBuffer;
+    cl::CommandQueue & queue = thread_data.m_commandqueue;
 
     auto skip_in_trans = false;
     for (auto iter = cbegin(m_layers); iter != cend(m_layers); iter++) {
@@ -526,7 +867,8 @@ void OpenCL_Network::forward(const std::vector<net_t>& input,
                      conv_weights,
                      nullptr,
                      bn_weights,
-                     skip_in_trans, skip_next_in_trans, true);
+                     skip_in_trans, skip_next_in_trans, true,
+                     batch_size);
             skip_in_trans = skip_next_in_trans;
         } else if (layer.is_residual_block) {
             assert(layer.channels == layer.outputs);
@@ -544,7 +886,8 @@ void OpenCL_Network::forward(const std::vector<net_t>& input,
                       conv1_weights,
                       nullptr,
                       bn1_weights,
-                      skip_in_trans, true, false);
+                      skip_in_trans, true, false,
+                      batch_size);
 
             auto skip_next_in_trans = false;
             if (niter->is_residual_block) {
@@ -559,16 +902,16 @@ void OpenCL_Network::forward(const std::vector<net_t>& input,
                       conv2_weights,
                       &inBuffer,
                       bn2_weights,
-                      true, skip_next_in_trans, true);
+                      true, skip_next_in_trans, true,
+                      batch_size);
             skip_in_trans = skip_next_in_trans;
-        } else {
-            assert(layer.is_convolve1);
-
+        } else if (layer.is_convolve1) {
+            // The policy convolution comes first, then the value one
             cl::Buffer out_buffer;
-            if (niter == cend(m_layers)) {
-                out_buffer = opencl_thread_data.m_pinnedOutBuffer_val;
+            if (niter->is_convolve1) {
+                out_buffer = thread_data.m_headBuffer_pol;
             } else {
-                out_buffer = opencl_thread_data.m_pinnedOutBuffer_pol;
+                out_buffer = thread_data.m_headBuffer_val;
             }
 
             convolve1(layer.channels,
@@ -576,32 +919,68 @@ void OpenCL_Network::forward(const std::vector<net_t>& input,
                     inBuffer,
                     out_buffer,
                     VBuffer,
-                    begin(layer.weights));
+                    begin(layer.weights),
+                    batch_size);
+        } else if (layer.is_policy_head) {
+            head_fc(layer.channels,
+                    layer.outputs,
+                    thread_data.m_headBuffer_pol,
+                    thread_data.m_pinnedOutBuffer_pol,
+                    begin(layer.weights),
+                    begin(layer.weights) + 2,
+                    false,
+                    batch_size);
+        } else {
+            assert(layer.is_value_head);
+            head_fc(layer.channels,
+                    layer.outputs,
+                    thread_data.m_headBuffer_val,
+                    thread_data.m_hiddenBuffer_val,
+                    begin(layer.weights),
+                    begin(layer.weights) + 2,
+                    true,
+                    batch_size);
+
+            cl::Kernel & value_out_kernel =
+                thread_data.m_value_out_kernel;
+            try {
+                value_out_kernel.setArg(0,
+                    thread_data.m_hiddenBuffer_val);
+                value_out_kernel.setArg(1,
+                    thread_data.m_pinnedOutBuffer_val);
+                value_out_kernel.setArg(2, layer.weights[4]);
+                value_out_kernel.setArg(3, layer.weights[5]);
+                value_out_kernel.setArg(4, int(layer.outputs));
+
+                queue.enqueueNDRangeKernel(value_out_kernel, cl::NullRange,
+                                           cl::NDRange(batch_size));
+            } catch (const cl::Error &e) {
+                std::cerr << "Error in value_out: " << e.what() << ": "
+                    << e.err() << std::endl;
+                throw;
+            }
         }
     }
 
-    auto pinnedOutBufferHost_pol = queue.enqueueMapBuffer(
-        opencl_thread_data.m_pinnedOutBuffer_pol, CL_FALSE,
-        CL_MAP_READ, 0, finalSize_pol);
-    auto pinnedOutBufferHost_val = queue.enqueueMapBuffer(
-        opencl_thread_data.m_pinnedOutBuffer_val, CL_FALSE,
-        CL_MAP_READ, 0, finalSize_val);
-
-    {
-        // Finish call is usually a busy wait. When using multiple threads
-        // use the lock to avoid busy waiting with all threads.
-        std::lock_guard<std::mutex> lock(m_queue_finish_mutex);
-        queue.finish();
-    }
-
-    std::memcpy(output_pol.data(), pinnedOutBufferHost_pol, finalSize_pol);
-    std::memcpy(output_val.data(), pinnedOutBufferHost_val, finalSize_val);
-
-    queue.enqueueUnmapMemObject(opencl_thread_data.m_pinnedOutBuffer_pol,
-            pinnedOutBufferHost_pol);
-    queue.enqueueUnmapMemObject(opencl_thread_data.m_pinnedOutBuffer_val,
-            pinnedOutBufferHost_val);
-
+    // The queue is in order, so the outputs are read back after the
+    // last kernel, and a later evaluation on this thread can be queued
+    // behind this one before it completes.
+    cl::Event read_done;
+    queue.enqueueReadBuffer(thread_data.m_pinnedOutBuffer_pol,
+                            CL_FALSE, 0, finalSize_pol, output_pol.data());
+    queue.enqueueReadBuffer(thread_data.m_pinnedOutBuffer_val,
+                            CL_FALSE, 0, finalSize_val, output_val.data(),
+                            nullptr, &read_done);
+
+    auto completion = std::make_unique<ForwardCompletion>();
+    completion->finished = std::move(finished);
+    auto result = completion->promise.get_future();
+    read_done.setCallback(CL_COMPLETE, forward_complete, completion.get());
+    // Owned by the callback from now on.
+    completion.release();
+    queue.flush();
+
+    return result;
 }
 
 void OpenCL_Network::convolve3(int channels, int outputs,
@@ -614,14 +993,16 @@ void OpenCL_Network::convolve3(int channels, int outputs,
                               weight_slice_t bn_weights,
                               bool skip_in_transform,
                               bool fuse_in_transform,
-                              bool store_inout) {
+                              bool store_inout,
+                              const size_t batch_size) {
+    auto& thread_data = m_opencl.ensure_thread_initialized();
 
-    cl::Kernel & in_transform_kernel = opencl_thread_data.m_in_transform_kernel;
-    cl::Kernel & sgemm_kernel = opencl_thread_data.m_sgemm_kernel;
+    cl::Kernel & in_transform_kernel = thread_data.m_in_transform_kernel;
+    cl::Kernel & sgemm_kernel = thread_data.m_sgemm_kernel;
     cl::Kernel & out_transform_bn_kernel =
-        opencl_thread_data.m_out_transform_bn_kernel;
+        thread_data.m_out_transform_bn_kernel;
     cl::Kernel & out_transform_bn_in_kernel =
-        opencl_thread_data.m_out_transform_bn_in_kernel;
+        thread_data.m_out_transform_bn_in_kernel;
 
     auto mwg = m_opencl.m_sgemm_tuners.mwg;
     auto nwg = m_opencl.m_sgemm_tuners.nwg;
@@ -647,10 +1028,28 @@ void OpenCL_Network::convolve3(int channels, int outputs,
 
     auto wgs = ceilMultiple(tiles, wavefront_size);
     auto m_ceil = int(ceilMultiple(ceilMultiple(outputs, mwg), vwm));
-    auto n_ceil = int(ceilMultiple(ceilMultiple(tiles, nwg), vwn));
+    auto n_ceil = int(ceilMultiple(ceilMultiple(tiles * batch_size, nwg), vwn));
     auto k_ceil = int(ceilMultiple(ceilMultiple(channels, kwg), vwm));
 
-    cl::CommandQueue & queue = opencl_thread_data.m_commandqueue;
+    cl::CommandQueue & queue = thread_data.m_commandqueue;
+
+    // Global sizes are padded to whole workgroups, the kernels skip
+    // the channels past the end.
+    const auto& tuners = m_opencl.m_transform_tuners;
+    auto in_global = cl::NDRange(wgs, channels, batch_size);
+    auto in_local = cl::NullRange;
+    if (tuners.in_lx != 0) {
+        in_global = cl::NDRange(wgs, ceilMultiple(channels, tuners.in_ly),
+                                batch_size);
+        in_local = cl::NDRange(tuners.in_lx, tuners.in_ly, 1);
+    }
+    auto out_global = cl::NDRange(outputs, wgs, batch_size);
+    auto out_local = cl::NullRange;
+    if (tuners.out_lx != 0) {
+        out_global = cl::NDRange(ceilMultiple(outputs, tuners.out_lx), wgs,
+                                 batch_size);
+        out_local = cl::NDRange(tuners.out_lx, tuners.out_ly, 1);
+    }
 
     if (!skip_in_transform) {
         try {
@@ -661,7 +1060,7 @@ void OpenCL_Network::convolve3(int channels, int outputs,
             in_transform_kernel.setArg(4, n_ceil);
 
             queue.enqueueNDRangeKernel(in_transform_kernel, cl::NullRange,
-                                       cl::NDRange(wgs, channels));
+                                       in_global, in_local);
         } catch (const cl::Error &e) {
             std::cerr << "Error in convolve3: " << e.what() << ": "
                 << e.err() << std::endl;
@@ -693,8 +1092,7 @@ void OpenCL_Network::convolve3(int channels, int outputs,
 
     try {
         if (fuse_in_transform) {
-            // TODO : Eventually this might also be something tuneable?
-            constexpr auto dim_size = 2;
+            const auto dim_size = tuners.outin_lx;
             out_transform_bn_in_kernel.setArg(0, bufferM);
             if (store_inout) {
                 out_transform_bn_in_kernel.setArg(1, bufferOut);
@@ -720,8 +1118,9 @@ void OpenCL_Network::convolve3(int channels, int outputs,
 
             queue.enqueueNDRangeKernel(out_transform_bn_in_kernel,
                                        cl::NullRange,
-                                       cl::NDRange(outputs, wgs),
-                                       cl::NDRange(dim_size, wgs));
+                                       cl::NDRange(ceilMultiple(outputs, dim_size),
+                                                   wgs, batch_size),
+                                       cl::NDRange(dim_size, wgs, 1));
         } else {
             out_transform_bn_kernel.setArg(0, bufferM);
             out_transform_bn_kernel.setArg(1, bufferOut);
@@ -737,7 +1136,7 @@ void OpenCL_Network::convolve3(int channels, int outputs,
             out_transform_bn_kernel.setArg(7, bn_weights[1]);
 
             queue.enqueueNDRangeKernel(out_transform_bn_kernel, cl::NullRange,
-                                       cl::NDRange(outputs, wgs));
+                                       out_global, out_local);
         }
     } catch (const cl::Error &e) {
         std::cerr << "Error in convolve3: " << e.what() << ": "
@@ -750,7 +1149,9 @@ void OpenCL_Network::convolve1(int channels, int outputs,
                               cl::Buffer& bufferInput,
                               cl::Buffer& bufferOutput,
                               cl::Buffer& bufferMerge,
-                              weight_slice_t weights) {
+                              weight_slice_t weights,
+                              const size_t batch_size) {
+    auto& thread_data = m_opencl.ensure_thread_initialized();
     // fixed for 19x19
     constexpr int width = 19;
     constexpr int height = 19;
@@ -763,11 +1164,12 @@ void OpenCL_Network::convolve1(int channels, int outputs,
     constexpr int rowGroup = 1;
     size_t outputGroup = std::min(outputs, 32);
 
-    auto m_convolve_kernel = &opencl_thread_data.m_convolve1_kernel;
+    auto m_convolve_kernel = &thread_data.m_convolve1_kernel;
 
 #ifndef NDEBUG
     // Total output size after reducing
-    size_t outSize = width * height * outputs * sizeof(net_t);
+    size_t outSize = batch_size * width * height * outputs
+        * m_opencl.storage_size();
 
     // Produce channel * output planes and merge them at the end
     size_t mergeSize = (channels >> channelShift) * outSize;
@@ -780,7 +1182,7 @@ void OpenCL_Network::convolve1(int channels, int outputs,
     int rowBuffer = std::min<int>(channelGroup, 7);
     size_t rowSize = channelGroup * outputGroup * rowBuffer * sizeof(float);
 
-    cl::CommandQueue & queue = opencl_thread_data.m_commandqueue;
+    cl::CommandQueue & queue = thread_data.m_commandqueue;
 
     try {
         m_convolve_kernel->setArg(0, bufferInput);
@@ -790,7 +1192,8 @@ void OpenCL_Network::convolve1(int channels, int outputs,
         m_convolve_kernel->setArg(4, cl::Local(rowSize));
 
         queue.enqueueNDRangeKernel(*m_convolve_kernel, cl::NullRange,
-                                   cl::NDRange(channels, outputs, rowTiles),
+                                   cl::NDRange(channels, outputs,
+                                               rowTiles * batch_size),
                                    cl::NDRange(channelGroup, outputGroup, rowGroup));
     } catch (const cl::Error &e) {
         std::cerr << "Error in convolve1: " << e.what() << ": "
@@ -798,7 +1201,7 @@ void OpenCL_Network::convolve1(int channels, int outputs,
         throw;
     }
 
-    cl::Kernel & merge_kernel = opencl_thread_data.m_merge_kernel;
+    cl::Kernel & merge_kernel = thread_data.m_merge_kernel;
     assert(channels % (1 << channelShift) == 0);
 
     try {
@@ -807,8 +1210,8 @@ void OpenCL_Network::convolve1(int channels, int outputs,
         merge_kernel.setArg(2, channels >> channelShift);
 
         queue.enqueueNDRangeKernel(merge_kernel, cl::NullRange,
-                                   cl::NDRange(outputs, boardsize),
-                                   cl::NDRange(std::min(8, outputs), 19));
+                                   cl::NDRange(outputs, boardsize, batch_size),
+                                   cl::NDRange(std::min(8, outputs), 19, 1));
     } catch (const cl::Error &e) {
         std::cerr << "Error in merge: " << e.what() << ": "
 	        << e.err() << std::endl;
@@ -816,6 +1219,36 @@ void OpenCL_Network::convolve1(int channels, int outputs,
     }
 }
 
+void OpenCL_Network::head_fc(int channels, int outputs,
+                             cl::Buffer& bufferInput,
+                             cl::Buffer& bufferOutput,
+                             weight_slice_t bn_weights,
+                             weight_slice_t ip_weights,
+                             bool relu,
+                             const size_t batch_size) {
+    auto& thread_data = m_opencl.ensure_thread_initialized();
+    cl::Kernel & head_fc_kernel = thread_data.m_head_fc_kernel;
+    cl::CommandQueue & queue = thread_data.m_commandqueue;
+
+    try {
+        head_fc_kernel.setArg(0, bufferInput);
+        head_fc_kernel.setArg(1, bufferOutput);
+        head_fc_kernel.setArg(2, bn_weights[0]);
+        head_fc_kernel.setArg(3, bn_weights[1]);
+        head_fc_kernel.setArg(4, ip_weights[0]);
+        head_fc_kernel.setArg(5, ip_weights[1]);
+        head_fc_kernel.setArg(6, channels);
+        head_fc_kernel.setArg(7, int(relu));
+
+        queue.enqueueNDRangeKernel(head_fc_kernel, cl::NullRange,
+                                   cl::NDRange(outputs, batch_size));
+    } catch (const cl::Error &e) {
+        std::cerr << "Error in head_fc: " << e.what() << ": "
+            << e.err() << std::endl;
+        throw;
+    }
+}
+
 template<class T>
 static std::string opencl_dev_type_to_string(T type) {
     if (type == CL_DEVICE_TYPE_CPU) {
@@ -911,6 +1344,37 @@ void OpenCL::process_tuners(std::string tuners) {
     }
 }
 
+void OpenCL::process_transform_tuners(std::string tuners) {
+    std::string buf;
+    std::stringstream ss(tuners);
+    std::size_t found;
+
+    while (ss >> buf) {
+        found = buf.find("=");
+        if (found == std::string::npos) {
+            std::cerr << "Invalid tuner string: " << tuners << std::endl;
+            std::exit(-1);
+        }
+        std::string name = buf.substr(0, found);
+        auto value = std::stoi(buf.substr(found + 1, std::string::npos));
+        if (name == "-DIN_LX") {
+            m_transform_tuners.in_lx = value;
+        }
+        if (name == "-DIN_LY") {
+            m_transform_tuners.in_ly = value;
+        }
+        if (name == "-DOUT_LX") {
+            m_transform_tuners.out_lx = value;
+        }
+        if (name == "-DOUT_LY") {
+            m_transform_tuners.out_ly = value;
+        }
+        if (name == "-DOUTIN_LX") {
+            m_transform_tuners.outin_lx = value;
+        }
+    }
+}
+
 std::vector<size_t> OpenCL::get_sgemm_tuners(void) {
     std::vector<size_t> tuners;
 
@@ -926,7 +1390,11 @@ std::vector<size_t> OpenCL::get_sgemm_tuners(void) {
 }
 
 void OpenCL::initialize(const int channels, const std::vector<int> & gpus,
+                        const size_t batch_size, const bool half,
                         bool silent) {
+    m_batch_size = batch_size;
+    m_half = half;
+
     std::vector<cl::Platform> platforms;
     try {
         cl::Platform::get(&platforms);
@@ -1040,23 +1508,22 @@ void OpenCL::initialize(const int channels, const std::vector<int> & gpus,
     m_context = context;
     m_device = best_device;
 
-    // Make program of the source code in the context
-    try {
-        m_program = cl::Program(m_context,
-                                  sourceCode_config
-                                + sourceCode_convolve1
-                                + sourceCode_convolve3
-                                + sourceCode_sgemm);
-    } catch (const cl::Error &e) {
-        myprintf("Error getting kernels: %s: %d", e.what(), e.err());
-        throw std::runtime_error("Error getting OpenCL kernels.");
-    }
-
     m_cl_args = cl_args;
+    if (m_half) {
+        const auto extensions = m_device.getInfo<CL_DEVICE_EXTENSIONS>();
+        if (extensions.find("cl_khr_fp16") == std::string::npos) {
+            throw std::runtime_error(
+                "OpenCL device doesn't support half precision.");
+        }
+        m_cl_args += " -DUSE_HALF";
+    }
 
+    // The tiles of every position in a batch share one SGEMM, so the
+    // best tiling depends on the batch size.
     auto t = Tuner(*this, m_context, m_device);
     auto sgemm_tuners =
-        t.load_sgemm_tuners(channels, WINOGRAD_P, channels, WINOGRAD_TILE);
+        t.load_sgemm_tuners(channels, WINOGRAD_P * batch_size, channels,
+                            WINOGRAD_TILE);
 
     // Exit immediately after tuning. Some NVIDIA drivers are buggy
     // and will fail to compile the rest of the kernels after a tuning
@@ -1066,21 +1533,19 @@ void OpenCL::initialize(const int channels, const std::vector<int> & gpus,
     }
 
     // Build program for these specific devices
-    try {
-        std::string args = cl_args;
-        args += sgemm_tuners;
-        m_program.build(args.c_str());
-    } catch (const cl::Error&) {
-        myprintf("Error building kernels: %s\n",
-                 m_program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(m_device).c_str());
-        throw std::runtime_error("Error building OpenCL kernels.");
-    }
-
-    ensure_thread_initialized();
+    build_program(sourceCode_config
+                  + sourceCode_convolve1
+                  + sourceCode_convolve3
+                  + sourceCode_input
+                  + sourceCode_heads
+                  + sourceCode_sgemm,
+                  m_cl_args + sgemm_tuners);
+
+    auto& thread_data = ensure_thread_initialized();
     process_tuners(sgemm_tuners);
 
     m_wavefront_size =
-        opencl_thread_data.m_sgemm_kernel.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(
+        thread_data.m_sgemm_kernel.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(
             best_device);
     myprintf("Wavefront/Warp size: %d\n", m_wavefront_size);
 
@@ -1094,9 +1559,116 @@ void OpenCL::initialize(const int channels, const std::vector<int> & gpus,
     }
     myprintf("\n");
 
+    auto transform_tuners = t.load_transform_tuners(channels, m_batch_size);
+    process_transform_tuners(transform_tuners);
+
     m_init_ok = true;
 }
 
+// FNV-1a, the hash has to be the same for every build of the program.
+template <typename Bytes>
+static std::uint64_t stable_hash(const Bytes& data) {
+    auto hash = std::uint64_t{14695981039346656037ULL};
+    for (const auto c : data) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= std::uint64_t{1099511628211ULL};
+    }
+    return hash;
+}
+
+// First line of a file of compiled kernels. The size and hash of the
+// binary tell whether the rest of the file is complete.
+static std::string binary_header(const std::string& key,
+                                 const std::vector<unsigned char>& binary) {
+    return key + ";" + std::to_string(binary.size())
+        + ";" + std::to_string(stable_hash(binary));
+}
+
+void OpenCL::build_program(const std::string& source,
+                           const std::string& args) {
+    // Everything that changes the compiled code goes into the key.
+    const auto key = trim(m_device.getInfo<CL_DEVICE_NAME>()) + ";"
+        + m_device.getInfo<CL_DEVICE_VENDOR>() + ";"
+        + m_device.getInfo<CL_DRIVER_VERSION>() + ";"
+        + args + ";"
+        + std::to_string(stable_hash(source));
+    const auto filename = BINARY_FILE_LOCAL
+        + boost::str(boost::format("_%016x") % stable_hash(key));
+
+    {
+        auto file = std::ifstream{filename, std::ios::binary};
+        auto header = std::string{};
+        if (std::getline(file, header)
+            && header.compare(0, key.size() + 1, key + ";") == 0) {
+            auto binary = std::vector<unsigned char>(
+                std::istreambuf_iterator<char>{file},
+                std::istreambuf_iterator<char>{});
+            if (header == binary_header(key, binary)) {
+                try {
+                    m_program = cl::Program(m_context, {m_device}, {binary});
+                    m_program.build(args.c_str());
+                    myprintf("Loaded compiled OpenCL kernels.\n");
+                    return;
+                } catch (const cl::Error&) {
+                    // Driver rejected it, compile from source instead
+                    myprintf("Could not use compiled OpenCL kernels"
+                             " in %s.\n", filename.c_str());
+                }
+            } else {
+                // Not all of what was written, never give it to the
+                // driver.
+                myprintf("Ignoring incomplete compiled OpenCL kernels"
+                         " in %s.\n", filename.c_str());
+            }
+        }
+    }
+
+    try {
+        m_program = cl::Program(m_context, source);
+    } catch (const cl::Error &e) {
+        myprintf("Error getting kernels: %s: %d", e.what(), e.err());
+        throw std::runtime_error("Error getting OpenCL kernels.");
+    }
+
+    try {
+        m_program.build(args.c_str());
+    } catch (const cl::Error&) {
+        myprintf("Error building kernels: %s\n",
+                 m_program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(m_device).c_str());
+        throw std::runtime_error("Error building OpenCL kernels.");
+    }
+
+    const auto binaries = m_program.getInfo<CL_PROGRAM_BINARIES>();
+    if (binaries.size() != 1 || binaries[0].empty()) {
+        return;
+    }
+    // Several processes can share the working directory, like the
+    // ones autogtp runs. The file is written under a name of its own
+    // and renamed into place, so nobody reads it half written.
+    std::random_device random;
+    const auto tmpname = filename
+        + boost::str(boost::format(".%08x%08x.tmp") % random() % random());
+    {
+        auto file = std::ofstream{tmpname, std::ios::binary};
+        file << binary_header(key, binaries[0]) << '\n';
+        file.write(reinterpret_cast<const char*>(binaries[0].data()),
+                   binaries[0].size());
+        file.close();
+        if (file.fail()) {
+            myprintf("Could not save the compiled OpenCL kernels.\n");
+            myprintf("Do I have write permissions on %s?\n",
+                     tmpname.c_str());
+            std::remove(tmpname.c_str());
+            return;
+        }
+    }
+    if (std::rename(tmpname.c_str(), filename.c_str()) != 0) {
+        // Windows doesn't replace existing files, another process
+        // saved the same kernels first.
+        std::remove(tmpname.c_str());
+    }
+}
+
 std::string OpenCL::get_device_name() {
     std::stringstream ss;
 
@@ -26,6 +26,9 @@
 #define CL_HPP_ENABLE_EXCEPTIONS
 #include <CL/cl2.hpp>
 #include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <future>
 #include <memory>
 #include <string>
 #include <vector>
@@ -47,6 +50,10 @@ private:
     bool is_input_convolution{false};
     bool is_residual_block{false};
     bool is_convolve1{false};
+    // Fully connected heads. channels are the planes of the head
+    // convolution, outputs the policy moves or the hidden value units.
+    bool is_policy_head{false};
+    bool is_value_head{false};
     std::vector<cl::Buffer> weights;
 };
 
@@ -62,12 +69,21 @@ private:
     cl::Kernel m_sgemm_kernel;
     cl::Kernel m_out_transform_bn_kernel;
     cl::Kernel m_out_transform_bn_in_kernel;
+    cl::Kernel m_expand_input_kernel;
+    cl::Kernel m_head_fc_kernel;
+    cl::Kernel m_value_out_kernel;
     cl::Buffer m_inBuffer;
     cl::Buffer m_inBuffer2;
+    cl::Buffer m_packedBuffer;
     cl::Buffer m_VBuffer;
     cl::Buffer m_MBuffer;
+    cl::Buffer m_headBuffer_pol;
+    cl::Buffer m_headBuffer_val;
+    cl::Buffer m_hiddenBuffer_val;
     cl::Buffer m_pinnedOutBuffer_pol;
     cl::Buffer m_pinnedOutBuffer_val;
+    // Input converted to half precision
+    std::vector<std::uint16_t> m_half_input;
     bool m_buffers_allocated{false};
 };
 
@@ -126,13 +142,51 @@ public:
         m_layers[layer].channels = channels;
     }
 
+    void push_policy_head(const std::vector<float>& means,
+                          const std::vector<float>& stddivs,
+                          const std::vector<float>& ip_w,
+                          const std::vector<float>& ip_b);
+
+    void push_value_head(const std::vector<float>& means,
+                         const std::vector<float>& stddivs,
+                         const std::vector<float>& ip1_w,
+                         const std::vector<float>& ip1_b,
+                         const std::vector<float>& ip2_w,
+                         const std::vector<float>& ip2_b);
+
     size_t get_layer_count() const {
         return m_layers.size();
     }
 
+    // Evaluates batch_size positions, stored back to back. The outputs
+    // are the policy logits and the value before tanh of each position.
     void forward(const std::vector<net_t>& input,
             std::vector<net_t>& output_pol,
-            std::vector<net_t>& output_val);
+            std::vector<net_t>& output_val,
+            const size_t batch_size = 1);
+
+    // Same, with the positions packed by Network::pack_input. They are
+    // expanded and rotated on the device.
+    void forward(const std::vector<std::uint32_t>& input,
+            std::vector<net_t>& output_pol,
+            std::vector<net_t>& output_val,
+            const size_t batch_size = 1);
+
+    // Queues the evaluation and returns without waiting for it.
+    // The input and outputs must stay alive until the future is ready.
+    // Evaluations from the same thread complete in order. finished is
+    // called by the OpenCL runtime when the evaluation is done or
+    // failed, just before the future becomes ready.
+    std::future<void> forward_async(const std::vector<net_t>& input,
+            std::vector<net_t>& output_pol,
+            std::vector<net_t>& output_val,
+            const size_t batch_size = 1,
+            std::function<void()> finished = nullptr);
+    std::future<void> forward_async(const std::vector<std::uint32_t>& input,
+            std::vector<net_t>& output_pol,
+            std::vector<net_t>& output_val,
+            const size_t batch_size = 1,
+            std::function<void()> finished = nullptr);
 
 private:
     using weight_slice_t = std::vector<cl::Buffer>::const_iterator;
@@ -142,6 +196,14 @@ private:
     }
     void add_weights(size_t layer, size_t size, const float* weights);
 
+    void ensure_buffers_allocated(ThreadData& thread_data);
+    // Runs the network on the input in m_inBuffer.
+    std::future<void> forward_layers(ThreadData& thread_data,
+                                     std::vector<net_t>& output_pol,
+                                     std::vector<net_t>& output_val,
+                                     const size_t batch_size,
+                                     std::function<void()> finished);
+
     void convolve3(int channels, int outputs,
                     cl::Buffer& bufferIn,
                     cl::Buffer& bufferOut,
@@ -150,31 +212,42 @@ private:
                     cl::Buffer* bufferResidual,
                     weight_slice_t bn_weights,
                     bool skip_in_transform,
-                    bool fuse_in_transform, bool store_inout);
+                    bool fuse_in_transform, bool store_inout,
+                    const size_t batch_size);
 
     void convolve1(int channels, int outputs,
                   cl::Buffer& bufferInput,
                   cl::Buffer& bufferOutput,
                   cl::Buffer& bufferMerge,
-                  weight_slice_t weights);
+                  weight_slice_t weights,
+                  const size_t batch_size);
 
-    OpenCL & m_opencl;
+    void head_fc(int channels, int outputs,
+                 cl::Buffer& bufferInput,
+                 cl::Buffer& bufferOutput,
+                 weight_slice_t bn_weights,
+                 weight_slice_t ip_weights,
+                 bool relu,
+                 const size_t batch_size);
 
-    // this mutex is not required for correctness, but this exists simply
-    // because queue.finish() is a busy wait and having a lot of threads
-    // waiting here is counterproductive CPU-wise.  At least std::mutex
-    // isn't busy wait so it should be better.
-    std::mutex m_queue_finish_mutex;
+    OpenCL & m_opencl;
     std::vector<Layer> m_layers;
+    size_t m_policy_outputs{0};
+    size_t m_value_hidden{0};
 };
 
 class OpenCL {
     friend class OpenCL_Network;
     friend class Tuner;
 public:
+    OpenCL();
+    // With half, weights and activations are stored in half precision
+    // on the device. Throws if the device can't do that.
     void initialize(const int channels, const std::vector<int> & gpus,
+                    const size_t batch_size = 1, const bool half = false,
                     bool silent = false);
-    void ensure_thread_initialized(void);
+    // Kernels and buffers of the calling thread for this device.
+    ThreadData& ensure_thread_initialized(void);
     std::string get_device_name();
 
     std::vector<size_t> get_sgemm_tuners(void);
@@ -183,7 +256,10 @@ public:
     cl::Context m_context;
 private:
     void tune_sgemm(void);
+    // Builds the kernels, reusing a binary from an earlier run if possible.
+    void build_program(const std::string& source, const std::string& args);
     void process_tuners(std::string tuners);
+    void process_transform_tuners(std::string tuners);
 
     cl::Program m_program;
     std::string m_cl_args;
@@ -194,13 +270,28 @@ private:
         size_t mdimc, ndimc;
     };
     sgemm_tuners m_sgemm_tuners;
+    // Local work sizes of the transform kernels, 0 lets the driver choose.
+    struct transform_tuners {
+        size_t in_lx{0}, in_ly{0};
+        size_t out_lx{0}, out_ly{0};
+        size_t outin_lx{2};
+    };
+    transform_tuners m_transform_tuners;
+    // Largest batch the per thread buffers are allocated for
+    size_t m_batch_size{1};
+    // Weights and activations stored as half
+    bool m_half{false};
+    size_t storage_size() const {
+        return m_half ? sizeof(std::uint16_t) : sizeof(float);
+    }
     size_t m_wavefront_size{0};
     size_t m_max_workgroup_size{0};
     std::vector<size_t> m_max_workgroup_dims;
     bool m_init_ok{false};
+    // Identifies the per thread data of this device
+    const size_t m_id;
 };
 
-extern thread_local ThreadData opencl_thread_data;
 extern const std::string sourceCode_sgemm;
 
 #endif
@@ -18,12 +18,19 @@
 #include "config.h"
 
 #ifdef USE_OPENCL
+#include <algorithm>
+#include <cassert>
+#include <future>
+#include <limits>
+
 #include "GTP.h"
+#include "Network.h"
 #include "Random.h"
 #include "OpenCLScheduler.h"
+#include "Timing.h"
+#include "Utils.h"
 
-thread_local auto current_thread_gpu_num = size_t{0};
-OpenCLScheduler opencl;
+using Utils::ceilMultiple;
 
 void OpenCLScheduler::initialize(const int channels) {
     // multi-gpu?
@@ -32,51 +39,235 @@ void OpenCLScheduler::initialize(const int channels) {
         for(auto gpu : cfg_gpus) {
             auto opencl = std::make_unique<OpenCL>();
             auto net = std::make_unique<OpenCL_Network>(*opencl);
-            opencl->initialize(channels, {gpu}, silent);
+            opencl->initialize(channels, {gpu}, cfg_batch_size,
+                               m_precision == Precision::HALF, silent);
             m_opencl.push_back(std::move(opencl));
             m_networks.push_back(std::move(net));
 
-            // Clear thread data on every init call.  We don't know which GPU
-            // this thread will be eventually be assigned to
-            opencl_thread_data = ThreadData();
-
             // starting next GPU, let's not dump full list of GPUs
             silent = true;
         }
-
-        for(size_t gnum = 0; gnum < m_networks.size(); gnum++) {
-            // launch the worker thread.  2 threads so that we can fully
-            // utilize GPU, since the worker thread consists of some CPU
-            // work for task preparation.
-            constexpr auto num_threads = 2;
-            for(auto i = 0; i < num_threads; i++) {
-                m_threadpool.add_thread([gnum] {
-                    current_thread_gpu_num = gnum;
-                });
-            }
-        }
+        m_load = std::vector<DeviceLoad>(m_networks.size());
     } else {
         auto opencl = std::make_unique<OpenCL>();
         auto net = std::make_unique<OpenCL_Network>(*opencl);
-        opencl->initialize(channels, {});
+        opencl->initialize(channels, {}, cfg_batch_size,
+                           m_precision == Precision::HALF);
 
         m_opencl.push_back(std::move(opencl));
         m_networks.push_back(std::move(net));
     }
 }
 
-void OpenCLScheduler::forward(const std::vector<net_t>& input,
-                              std::vector<net_t>& output_pol,
-                              std::vector<net_t>& output_val) {
+std::string OpenCLScheduler::get_name() const {
+    return "OpenCL";
+}
+
+size_t OpenCLScheduler::get_max_batch_size() const {
+    return cfg_batch_size;
+}
+
+ForwardPipe::Precision OpenCLScheduler::get_precision() const {
+    return m_precision;
+}
+
+// The OpenCL SGEMM works on padded Winograd matrices. The padding depends
+// on the tuning of each device, so every device gets its own copy.
+static std::vector<float> transform_and_pad(OpenCL& opencl,
+                                            const std::vector<float>& weights,
+                                            const unsigned int outputs,
+                                            const unsigned int channels) {
+    auto tuners = opencl.get_sgemm_tuners();
+
+    auto mwg = tuners[0];
+    auto kwg = tuners[2];
+    auto vwm = tuners[3];
+
+    size_t m_ceil = ceilMultiple(ceilMultiple(outputs, mwg), vwm);
+    size_t k_ceil = ceilMultiple(ceilMultiple(channels, kwg), vwm);
+
+    auto U = Network::winograd_transform_f(weights, outputs, channels);
+    return Network::zeropad_U(U, outputs, channels, m_ceil, k_ceil);
+}
+
+void OpenCLScheduler::push_input_convolution(unsigned int filter_size,
+                                             unsigned int channels,
+                                             unsigned int outputs,
+                                             const std::vector<float>& weights,
+                                             const std::vector<float>& means,
+                                             const std::vector<float>& variances) {
+    assert(filter_size == 3);
+    (void)filter_size;
+    for (auto & opencl_net : m_networks) {
+        auto Upad = transform_and_pad(opencl_net->getOpenCL(), weights,
+                                      outputs, channels);
+        // Winograd filter transformation changes filter size to 4x4
+        opencl_net->push_input_convolution(Network::WINOGRAD_ALPHA,
+                                           channels, outputs,
+                                           Upad, means, variances);
+    }
+}
+
+void OpenCLScheduler::push_residual(unsigned int filter_size,
+                                    unsigned int channels,
+                                    unsigned int outputs,
+                                    const std::vector<float>& weights_1,
+                                    const std::vector<float>& means_1,
+                                    const std::vector<float>& variances_1,
+                                    const std::vector<float>& weights_2,
+                                    const std::vector<float>& means_2,
+                                    const std::vector<float>& variances_2) {
+    assert(filter_size == 3);
+    (void)filter_size;
+    for (auto & opencl_net : m_networks) {
+        auto Upad1 = transform_and_pad(opencl_net->getOpenCL(), weights_1,
+                                       outputs, channels);
+        auto Upad2 = transform_and_pad(opencl_net->getOpenCL(), weights_2,
+                                       outputs, outputs);
+        opencl_net->push_residual(Network::WINOGRAD_ALPHA, channels, outputs,
+                                  Upad1, means_1, variances_1,
+                                  Upad2, means_2, variances_2);
+    }
+}
+
+void OpenCLScheduler::push_convolve1(unsigned int channels,
+                                     unsigned int outputs,
+                                     const std::vector<float>& weights) {
+    for (auto & opencl_net : m_networks) {
+        opencl_net->push_convolve1(channels, outputs, weights);
+    }
+}
+
+void OpenCLScheduler::push_policy_head(const std::vector<float>& means,
+                                       const std::vector<float>& stddivs,
+                                       const std::vector<float>& ip_w,
+                                       const std::vector<float>& ip_b) {
+    for (auto & opencl_net : m_networks) {
+        opencl_net->push_policy_head(means, stddivs, ip_w, ip_b);
+    }
+}
+
+void OpenCLScheduler::push_value_head(const std::vector<float>& means,
+                                      const std::vector<float>& stddivs,
+                                      const std::vector<float>& ip1_w,
+                                      const std::vector<float>& ip1_b,
+                                      const std::vector<float>& ip2_w,
+                                      const std::vector<float>& ip2_b) {
+    for (auto & opencl_net : m_networks) {
+        opencl_net->push_value_head(means, stddivs,
+                                    ip1_w, ip1_b, ip2_w, ip2_b);
+    }
+}
+
+void OpenCLScheduler::forward(const std::vector<float>& input,
+                              std::vector<float>& output_pol,
+                              std::vector<float>& output_val) {
+    forward_batch(1, input, output_pol, output_val);
+}
+
+void OpenCLScheduler::forward_batch(const size_t batch_size,
+                                    const std::vector<float>& input,
+                                    std::vector<float>& output_pol,
+                                    std::vector<float>& output_val) {
+    if (batch_size > get_max_batch_size()) {
+        ForwardPipe::forward_batch(batch_size, input, output_pol, output_val);
+        return;
+    }
+    forward_on_device(batch_size, input, output_pol, output_val);
+}
+
+void OpenCLScheduler::forward_packed(const size_t batch_size,
+                                     const std::vector<std::uint32_t>& input,
+                                     std::vector<float>& output_pol,
+                                     std::vector<float>& output_val) {
+    if (batch_size > get_max_batch_size()) {
+        ForwardPipe::forward_packed(batch_size, input, output_pol, output_val);
+        return;
+    }
+    forward_on_device(batch_size, input, output_pol, output_val);
+}
+
+std::future<void> OpenCLScheduler::forward_packed_async(
+    const size_t batch_size,
+    const std::vector<std::uint32_t>& input,
+    std::vector<float>& output_pol,
+    std::vector<float>& output_val) {
+    if (batch_size > get_max_batch_size()) {
+        return ForwardPipe::forward_packed_async(batch_size, input,
+                                                 output_pol, output_val);
+    }
     if (m_networks.size() == 1) {
-        m_networks[0]->forward(input, output_pol, output_val);
+        return m_networks[0]->forward_async(input, output_pol, output_val,
+                                            batch_size);
+    }
+
+    auto ahead = size_t{0};
+    const auto device = pick_device(batch_size, ahead);
+    const auto start = Time();
+    // The load is accounted as soon as the device is done, however
+    // long the caller takes to collect the result.
+    return m_networks[device]->forward_async(
+        input, output_pol, output_val, batch_size,
+        [this, device, batch_size, ahead, start]() {
+            complete(device, batch_size, ahead,
+                     Time::timediff_seconds(start, Time()));
+        });
+}
+
+template <typename T>
+void OpenCLScheduler::forward_on_device(const size_t batch_size,
+                                        const std::vector<T>& input,
+                                        std::vector<float>& output_pol,
+                                        std::vector<float>& output_val) {
+    if (m_networks.size() == 1) {
+        m_networks[0]->forward(input, output_pol, output_val, batch_size);
         return;
     }
 
-    auto f = m_threadpool.add_task([this, &input, &output_pol, &output_val]{
-        m_networks[current_thread_gpu_num]->forward(input, output_pol, output_val);
-    });
+    // The calling thread submits to the device itself, every thread
+    // has its own command queue on each device.
+    auto ahead = size_t{0};
+    const auto device = pick_device(batch_size, ahead);
+    const auto start = Time();
+    m_networks[device]->forward(input, output_pol, output_val, batch_size);
+    complete(device, batch_size, ahead,
+             Time::timediff_seconds(start, Time()));
+}
 
-    f.get();
+size_t OpenCLScheduler::pick_device(const size_t batch_size, size_t& ahead) {
+    // Send the work to the device expected to finish it first. Devices
+    // without a measurement yet all look equally fast, so they are
+    // filled evenly until they have one.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto best = size_t{0};
+    auto best_finish = std::numeric_limits<double>::max();
+    for (auto i = size_t{0}; i < m_load.size(); i++) {
+        const auto& load = m_load[i];
+        const auto seconds = std::max(load.seconds_per_position, 1e-6);
+        const auto finish = (load.pending + batch_size) * seconds;
+        if (finish < best_finish) {
+            best_finish = finish;
+            best = i;
+        }
+    }
+    ahead = m_load[best].pending;
+    m_load[best].pending += batch_size;
+    return best;
+}
+
+void OpenCLScheduler::complete(const size_t device, const size_t batch_size,
+                               const size_t ahead, const double seconds) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& load = m_load[device];
+    load.pending -= batch_size;
+    // The evaluation waited for the positions ahead of it, so the time
+    // per position is the elapsed time shared among all of them.
+    const auto sample = seconds / (ahead + batch_size);
+    if (load.seconds_per_position == 0.0) {
+        load.seconds_per_position = sample;
+    } else {
+        load.seconds_per_position =
+            0.95 * load.seconds_per_position + 0.05 * sample;
+    }
 }
 #endif
@@ -20,38 +20,101 @@
 #define OPENCL_SCHEDULER_H_INCLUDED
 #include "config.h"
 
-#include <vector>
+#include <cstdint>
 #include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
+#include "ForwardPipe.h"
 #include "OpenCL.h"
-#include "ThreadPool.h"
 
-class OpenCLScheduler {
+class OpenCLScheduler : public ForwardPipe {
 public:
-    void initialize(const int channels);
-    std::vector<std::unique_ptr<OpenCL_Network>> & get_networks() {
-        return m_networks;
-    }
-    void forward(const std::vector<net_t>& input,
-                 std::vector<net_t>& output_pol,
-                 std::vector<net_t>& output_val);
+    explicit OpenCLScheduler(const Precision precision = Precision::SINGLE)
+        : m_precision(precision) {}
+
+    virtual void initialize(const int channels);
+    virtual std::string get_name() const;
+    virtual Precision get_precision() const;
+    virtual size_t get_max_batch_size() const;
+
+    virtual void push_input_convolution(unsigned int filter_size,
+                                        unsigned int channels,
+                                        unsigned int outputs,
+                                        const std::vector<float>& weights,
+                                        const std::vector<float>& means,
+                                        const std::vector<float>& variances);
+
+    virtual void push_residual(unsigned int filter_size,
+                               unsigned int channels,
+                               unsigned int outputs,
+                               const std::vector<float>& weights_1,
+                               const std::vector<float>& means_1,
+                               const std::vector<float>& variances_1,
+                               const std::vector<float>& weights_2,
+                               const std::vector<float>& means_2,
+                               const std::vector<float>& variances_2);
+
+    virtual void push_convolve1(unsigned int channels,
+                                unsigned int outputs,
+                                const std::vector<float>& weights);
+
+    virtual void push_policy_head(const std::vector<float>& means,
+                                  const std::vector<float>& stddivs,
+                                  const std::vector<float>& ip_w,
+                                  const std::vector<float>& ip_b);
+
+    virtual void push_value_head(const std::vector<float>& means,
+                                 const std::vector<float>& stddivs,
+                                 const std::vector<float>& ip1_w,
+                                 const std::vector<float>& ip1_b,
+                                 const std::vector<float>& ip2_w,
+                                 const std::vector<float>& ip2_b);
+
+    virtual void forward(const std::vector<float>& input,
+                         std::vector<float>& output_pol,
+                         std::vector<float>& output_val);
+    virtual void forward_batch(const size_t batch_size,
+                               const std::vector<float>& input,
+                               std::vector<float>& output_pol,
+                               std::vector<float>& output_val);
+    virtual void forward_packed(const size_t batch_size,
+                                const std::vector<std::uint32_t>& input,
+                                std::vector<float>& output_pol,
+                                std::vector<float>& output_val);
+    virtual std::future<void> forward_packed_async(
+        const size_t batch_size,
+        const std::vector<std::uint32_t>& input,
+        std::vector<float>& output_pol,
+        std::vector<float>& output_val);
 private:
-    class ForwardTask {
-    public:
-        const std::vector<net_t> *input;
-        std::vector<net_t> * output;
-        std::promise<void> prom;
-        ForwardTask() : input(nullptr), output(nullptr) {}
-        ForwardTask(const std::vector<net_t> * in,
-                    std::vector<net_t> * out)
-            : input(in), output(out) {}
+    struct DeviceLoad {
+        // Positions submitted to the device and not finished yet
+        size_t pending{0};
+        // Moving average, 0 until the first evaluation finished
+        double seconds_per_position{0.0};
     };
 
+    // Pick the least loaded device and account batch_size positions
+    // to it. ahead is set to the positions already pending there.
+    size_t pick_device(const size_t batch_size, size_t& ahead);
+    void complete(const size_t device, const size_t batch_size,
+                  const size_t ahead, const double seconds);
+    // Float planes or packed positions, on the least loaded device.
+    template <typename T>
+    void forward_on_device(const size_t batch_size,
+                           const std::vector<T>& input,
+                           std::vector<float>& output_pol,
+                           std::vector<float>& output_val);
+
+    Precision m_precision;
     std::vector<std::unique_ptr<OpenCL_Network>> m_networks;
     std::vector<std::unique_ptr<OpenCL>> m_opencl;
-    Utils::ThreadPool m_threadpool;
-};
 
-extern OpenCLScheduler opencl;
+    std::mutex m_mutex;
+    std::vector<DeviceLoad> m_load;
+};
 
 #endif
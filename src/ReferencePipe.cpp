@@ -0,0 +1,226 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "ReferencePipe.h"
+
+#include <algorithm>
+#include <cassert>
+#include <string>
+#include <vector>
+
+#include "Network.h"
+
+constexpr auto WIDTH = 19;
+constexpr auto HEIGHT = 19;
+constexpr auto BOARD_SQUARES = WIDTH * HEIGHT;
+
+void ReferencePipe::initialize(const int channels) {
+    (void)channels;
+}
+
+std::string ReferencePipe::get_name() const {
+    return "reference";
+}
+
+void ReferencePipe::convolve3(const ConvLayer& layer,
+                              const std::vector<float>& input,
+                              std::vector<float>& output) {
+    // Weight shape (output, input, 3, 3), zero padded borders
+    for (auto o = size_t{0}; o < layer.outputs; o++) {
+        auto out = &output[o * BOARD_SQUARES];
+        std::fill(out, out + BOARD_SQUARES, 0.0f);
+        for (auto c = size_t{0}; c < layer.channels; c++) {
+            auto in = &input[c * BOARD_SQUARES];
+            auto w = &layer.weights[(o * layer.channels + c) * 9];
+            for (auto y = 0; y < HEIGHT; y++) {
+                for (auto x = 0; x < WIDTH; x++) {
+                    auto acc = 0.0f;
+                    for (auto fy = 0; fy < 3; fy++) {
+                        const auto iy = y + fy - 1;
+                        if (iy < 0 || iy >= HEIGHT) continue;
+                        for (auto fx = 0; fx < 3; fx++) {
+                            const auto ix = x + fx - 1;
+                            if (ix < 0 || ix >= WIDTH) continue;
+                            acc += w[fy * 3 + fx] * in[iy * WIDTH + ix];
+                        }
+                    }
+                    out[y * WIDTH + x] += acc;
+                }
+            }
+        }
+    }
+}
+
+void ReferencePipe::convolve1(const unsigned int channels,
+                              const unsigned int outputs,
+                              const std::vector<float>& weights,
+                              const std::vector<float>& input,
+                              std::vector<float>& output) {
+    for (auto o = size_t{0}; o < outputs; o++) {
+        auto out = &output[o * BOARD_SQUARES];
+        std::fill(out, out + BOARD_SQUARES, 0.0f);
+        for (auto c = size_t{0}; c < channels; c++) {
+            const auto w = weights[o * channels + c];
+            auto in = &input[c * BOARD_SQUARES];
+            for (auto b = 0; b < BOARD_SQUARES; b++) {
+                out[b] += w * in[b];
+            }
+        }
+    }
+}
+
+void ReferencePipe::batchnorm(const ConvLayer& layer,
+                              std::vector<float>& data,
+                              const float* const eltwise) {
+    for (auto c = size_t{0}; c < layer.outputs; c++) {
+        auto arr = &data[c * BOARD_SQUARES];
+        for (auto b = 0; b < BOARD_SQUARES; b++) {
+            auto val = layer.stddivs[c] * (arr[b] - layer.means[c]);
+            if (eltwise != nullptr) {
+                val += eltwise[c * BOARD_SQUARES + b];
+            }
+            arr[b] = std::max(val, 0.0f);
+        }
+    }
+}
+
+void ReferencePipe::batchnorm_relu(const std::vector<float>& means,
+                                   const std::vector<float>& stddivs,
+                                   std::vector<float>& data) {
+    for (auto c = size_t{0}; c < means.size(); c++) {
+        auto arr = &data[c * BOARD_SQUARES];
+        for (auto b = 0; b < BOARD_SQUARES; b++) {
+            arr[b] = std::max(stddivs[c] * (arr[b] - means[c]), 0.0f);
+        }
+    }
+}
+
+void ReferencePipe::innerproduct(const std::vector<float>& weights,
+                                 const std::vector<float>& biases,
+                                 const std::vector<float>& input,
+                                 std::vector<float>& output,
+                                 const bool relu) {
+    // Weight shape (output, input)
+    const auto inputs = input.size();
+    for (auto o = size_t{0}; o < biases.size(); o++) {
+        auto val = biases[o];
+        for (auto i = size_t{0}; i < inputs; i++) {
+            val += weights[o * inputs + i] * input[i];
+        }
+        output[o] = relu ? std::max(val, 0.0f) : val;
+    }
+}
+
+void ReferencePipe::forward(const std::vector<float>& input,
+                            std::vector<float>& output_pol,
+                            std::vector<float>& output_val) {
+    const auto channels = m_layers[0].outputs;
+    auto conv_out = std::vector<float>(channels * BOARD_SQUARES);
+    auto conv_in = std::vector<float>(channels * BOARD_SQUARES);
+
+    convolve3(m_layers[0], input, conv_out);
+    batchnorm(m_layers[0], conv_out, nullptr);
+
+    for (auto i = size_t{1}; i < m_layers.size(); i += 2) {
+        auto res = conv_out;
+        convolve3(m_layers[i], res, conv_in);
+        batchnorm(m_layers[i], conv_in, nullptr);
+        convolve3(m_layers[i + 1], conv_in, conv_out);
+        batchnorm(m_layers[i + 1], conv_out, res.data());
+    }
+
+    auto policy_data =
+        std::vector<float>(Network::OUTPUTS_POLICY * BOARD_SQUARES);
+    auto value_data =
+        std::vector<float>(Network::OUTPUTS_VALUE * BOARD_SQUARES);
+    convolve1(m_head_channels, Network::OUTPUTS_POLICY,
+              m_conv_pol_w, conv_out, policy_data);
+    convolve1(m_head_channels, Network::OUTPUTS_VALUE,
+              m_conv_val_w, conv_out, value_data);
+
+    batchnorm_relu(m_bn_pol_means, m_bn_pol_stddivs, policy_data);
+    innerproduct(m_ip_pol_w, m_ip_pol_b, policy_data, output_pol, false);
+
+    batchnorm_relu(m_bn_val_means, m_bn_val_stddivs, value_data);
+    auto hidden = std::vector<float>(Network::VALUE_HIDDEN);
+    innerproduct(m_ip1_val_w, m_ip1_val_b, value_data, hidden, true);
+    innerproduct(m_ip2_val_w, m_ip2_val_b, hidden, output_val, false);
+}
+
+void ReferencePipe::push_input_convolution(unsigned int filter_size,
+                                           unsigned int channels,
+                                           unsigned int outputs,
+                                           const std::vector<float>& weights,
+                                           const std::vector<float>& means,
+                                           const std::vector<float>& variances) {
+    assert(filter_size == 3);
+    (void)filter_size;
+    m_layers.push_back({channels, outputs, weights, means, variances});
+}
+
+void ReferencePipe::push_residual(unsigned int filter_size,
+                                  unsigned int channels,
+                                  unsigned int outputs,
+                                  const std::vector<float>& weights_1,
+                                  const std::vector<float>& means_1,
+                                  const std::vector<float>& variances_1,
+                                  const std::vector<float>& weights_2,
+                                  const std::vector<float>& means_2,
+                                  const std::vector<float>& variances_2) {
+    assert(filter_size == 3);
+    (void)filter_size;
+    m_layers.push_back({channels, outputs, weights_1, means_1, variances_1});
+    m_layers.push_back({outputs, outputs, weights_2, means_2, variances_2});
+}
+
+void ReferencePipe::push_convolve1(unsigned int channels,
+                                   unsigned int outputs,
+                                   const std::vector<float>& weights) {
+    m_head_channels = channels;
+    if (outputs == Network::OUTPUTS_POLICY) {
+        m_conv_pol_w = weights;
+    } else {
+        assert(outputs == Network::OUTPUTS_VALUE);
+        m_conv_val_w = weights;
+    }
+}
+
+void ReferencePipe::push_policy_head(const std::vector<float>& means,
+                                     const std::vector<float>& stddivs,
+                                     const std::vector<float>& ip_w,
+                                     const std::vector<float>& ip_b) {
+    m_bn_pol_means = means;
+    m_bn_pol_stddivs = stddivs;
+    m_ip_pol_w = ip_w;
+    m_ip_pol_b = ip_b;
+}
+
+void ReferencePipe::push_value_head(const std::vector<float>& means,
+                                    const std::vector<float>& stddivs,
+                                    const std::vector<float>& ip1_w,
+                                    const std::vector<float>& ip1_b,
+                                    const std::vector<float>& ip2_w,
+                                    const std::vector<float>& ip2_b) {
+    m_bn_val_means = means;
+    m_bn_val_stddivs = stddivs;
+    m_ip1_val_w = ip1_w;
+    m_ip1_val_b = ip1_b;
+    m_ip2_val_w = ip2_w;
+    m_ip2_val_b = ip2_b;
+}
@@ -0,0 +1,123 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef REFERENCEPIPE_H_INCLUDED
+#define REFERENCEPIPE_H_INCLUDED
+
+#include "config.h"
+
+#include <string>
+#include <vector>
+
+#include "ForwardPipe.h"
+
+/*
+    Straightforward direct convolution without BLAS or Winograd.
+    Slow, but simple enough to serve as a known-good reference
+    when validating the other backends.
+*/
+class ReferencePipe : public ForwardPipe {
+public:
+    virtual void initialize(const int channels);
+    virtual std::string get_name() const;
+
+    virtual void push_input_convolution(unsigned int filter_size,
+                                        unsigned int channels,
+                                        unsigned int outputs,
+                                        const std::vector<float>& weights,
+                                        const std::vector<float>& means,
+                                        const std::vector<float>& variances);
+
+    virtual void push_residual(unsigned int filter_size,
+                               unsigned int channels,
+                               unsigned int outputs,
+                               const std::vector<float>& weights_1,
+                               const std::vector<float>& means_1,
+                               const std::vector<float>& variances_1,
+                               const std::vector<float>& weights_2,
+                               const std::vector<float>& means_2,
+                               const std::vector<float>& variances_2);
+
+    virtual void push_convolve1(unsigned int channels,
+                                unsigned int outputs,
+                                const std::vector<float>& weights);
+
+    virtual void push_policy_head(const std::vector<float>& means,
+                                  const std::vector<float>& stddivs,
+                                  const std::vector<float>& ip_w,
+                                  const std::vector<float>& ip_b);
+
+    virtual void push_value_head(const std::vector<float>& means,
+                                 const std::vector<float>& stddivs,
+                                 const std::vector<float>& ip1_w,
+                                 const std::vector<float>& ip1_b,
+                                 const std::vector<float>& ip2_w,
+                                 const std::vector<float>& ip2_b);
+
+    virtual void forward(const std::vector<float>& input,
+                         std::vector<float>& output_pol,
+                         std::vector<float>& output_val);
+
+private:
+    struct ConvLayer {
+        unsigned int channels;
+        unsigned int outputs;
+        std::vector<float> weights;
+        std::vector<float> means;
+        std::vector<float> stddivs;
+    };
+
+    static void convolve3(const ConvLayer& layer,
+                          const std::vector<float>& input,
+                          std::vector<float>& output);
+    static void convolve1(const unsigned int channels,
+                          const unsigned int outputs,
+                          const std::vector<float>& weights,
+                          const std::vector<float>& input,
+                          std::vector<float>& output);
+    static void batchnorm(const ConvLayer& layer,
+                          std::vector<float>& data,
+                          const float* const eltwise);
+    static void batchnorm_relu(const std::vector<float>& means,
+                               const std::vector<float>& stddivs,
+                               std::vector<float>& data);
+    static void innerproduct(const std::vector<float>& weights,
+                             const std::vector<float>& biases,
+                             const std::vector<float>& input,
+                             std::vector<float>& output,
+                             const bool relu);
+
+    std::vector<ConvLayer> m_layers;
+    unsigned int m_head_channels{0};
+    std::vector<float> m_conv_pol_w;
+    std::vector<float> m_conv_val_w;
+
+    // Fully connected heads
+    std::vector<float> m_bn_pol_means;
+    std::vector<float> m_bn_pol_stddivs;
+    std::vector<float> m_ip_pol_w;
+    std::vector<float> m_ip_pol_b;
+    std::vector<float> m_bn_val_means;
+    std::vector<float> m_bn_val_stddivs;
+    std::vector<float> m_ip1_val_w;
+    std::vector<float> m_ip1_val_b;
+    std::vector<float> m_ip2_val_w;
+    std::vector<float> m_ip2_val_b;
+};
+
+#endif
@@ -0,0 +1,125 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "SelfCheck.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+#include "Utils.h"
+
+SelfCheck::SelfCheck(std::shared_ptr<ForwardPipe> reference,
+                     const float budget)
+    : m_reference(std::move(reference)), m_budget(budget) {
+    m_worker.add_thread(Utils::lower_thread_priority);
+}
+
+bool SelfCheck::submit(const std::vector<float>& input,
+                       const std::vector<float>& output_pol,
+                       const std::vector<float>& output_val) {
+    // One verification at a time, the search doesn't wait for it.
+    if (m_pending.exchange(true)) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const auto elapsed = Time::timediff_seconds(m_start, Time());
+        if (m_busy_seconds > m_budget * elapsed) {
+            m_pending = false;
+            return false;
+        }
+    }
+    m_worker.add_task([this, input, output_pol, output_val] {
+        verify(input, output_pol, output_val);
+    });
+    return true;
+}
+
+void SelfCheck::verify(const std::vector<float>& input,
+                       const std::vector<float>& output_pol,
+                       const std::vector<float>& output_val) {
+    const auto start = Time();
+    auto ref_pol = std::vector<float>(output_pol.size());
+    auto ref_val = std::vector<float>(output_val.size());
+    try {
+        m_reference->forward(input, ref_pol, ref_val);
+        compare(output_pol, ref_pol);
+        compare(output_val, ref_val);
+    } catch (const std::exception&) {
+        // Reported to the search threads by check_failures.
+        m_failed = true;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_busy_seconds += Time::timediff_seconds(start, Time());
+    }
+    m_pending = false;
+}
+
+void SelfCheck::check_failures() {
+    if (m_failed.exchange(false)) {
+        throw std::runtime_error("OpenCL self-check mismatch.");
+    }
+}
+
+template<typename T>
+static T relative_difference(T a, T b) {
+    // Handle NaN
+    if (std::isnan(a) || std::isnan(b)) {
+        return std::numeric_limits<T>::max();
+    }
+
+    constexpr auto small_number = 1e-3f;
+    auto fa = std::fabs(a);
+    auto fb = std::fabs(b);
+
+    if (fa > small_number && fb > small_number) {
+        // Handle sign difference
+        if (((a < 0) != (b < 0)) && (a != 0) && (b != 0)) {
+            return std::numeric_limits<T>::max();
+        }
+    }
+
+    // Handle underflow
+    fa = std::max(fa, small_number);
+    fb = std::max(fb, small_number);
+
+    return std::max(fabs((fa - fb) / fa), fabs((fa - fb) / fb));
+}
+
+void SelfCheck::compare(const std::vector<float>& data,
+                        const std::vector<float>& ref) {
+    // We accept an error up to 5%, but output values
+    // smaller than 1/1000th are "rounded up" for the comparison.
+    constexpr float relative_error = 5e-2f;
+    for (auto idx = size_t{0}; idx < data.size(); ++idx) {
+        auto err = relative_difference(data[idx], ref[idx]);
+        if (err > relative_error) {
+            printf("Error in OpenCL calculation: expected %f got %f "
+                   "(error=%f%%)\n", ref[idx], data[idx], err * 100.0);
+            printf("Update your GPU drivers or reduce the amount of games "
+                   "played simultaneously.\n");
+            throw std::runtime_error("OpenCL self-check mismatch.");
+        }
+    }
+}
@@ -0,0 +1,77 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SELFCHECK_H_INCLUDED
+#define SELFCHECK_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "ForwardPipe.h"
+#include "ThreadPool.h"
+#include "Timing.h"
+
+/*
+    Verifies results of a backend against a reference backend on a
+    background thread, so that the search threads don't wait for the
+    (slower) reference evaluation. Only one verification runs at a
+    time, and new ones are skipped while the time spent verifying
+    exceeds the budget.
+*/
+class SelfCheck {
+public:
+    // budget is the fraction of one CPU core verification may use.
+    SelfCheck(std::shared_ptr<ForwardPipe> reference, const float budget);
+
+    // Queue a verification of the outputs computed for input. Returns
+    // false if it was skipped because of the rate limit.
+    bool submit(const std::vector<float>& input,
+                const std::vector<float>& output_pol,
+                const std::vector<float>& output_val);
+
+    // Throws if a verification failed since the last call.
+    void check_failures();
+
+    // Throws if the outputs differ more than the allowed error.
+    static void compare(const std::vector<float>& data,
+                        const std::vector<float>& ref);
+
+private:
+    void verify(const std::vector<float>& input,
+                const std::vector<float>& output_pol,
+                const std::vector<float>& output_val);
+
+    std::shared_ptr<ForwardPipe> m_reference;
+    float m_budget;
+    Time m_start;
+
+    std::mutex m_mutex;
+    // Wall clock time spent in verifications, protected by m_mutex.
+    double m_busy_seconds{0.0};
+    std::atomic<bool> m_pending{false};
+    std::atomic<bool> m_failed{false};
+
+    // Declared last, so the worker is joined before the rest goes away.
+    Utils::ThreadPool m_worker;
+};
+
+#endif
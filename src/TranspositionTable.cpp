@@ -0,0 +1,54 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "TranspositionTable.h"
+
+std::uint32_t TranspositionTable::find(std::uint64_t hash) {
+    auto& shard = get_shard(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    const auto iter = shard.nodes.find(hash);
+    if (iter == shard.nodes.end()) {
+        return NONE;
+    }
+    return iter->second;
+}
+
+std::uint32_t TranspositionTable::insert(std::uint64_t hash,
+                                         std::uint32_t node) {
+    auto& shard = get_shard(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    return shard.nodes.emplace(hash, node).first->second;
+}
+
+void TranspositionTable::remap(
+    const std::function<std::uint32_t(std::uint32_t)>& new_index) {
+    for (auto& shard : m_shards) {
+        auto iter = shard.nodes.begin();
+        while (iter != shard.nodes.end()) {
+            iter->second = new_index(iter->second);
+            if (iter->second == NONE) {
+                iter = shard.nodes.erase(iter);
+            } else {
+                ++iter;
+            }
+        }
+    }
+}
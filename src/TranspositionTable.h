@@ -0,0 +1,71 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRANSPOSITIONTABLE_H_INCLUDED
+#define TRANSPOSITIONTABLE_H_INCLUDED
+
+#include "config.h"
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+/*
+    The node of every position in a search graph, by the hash of the
+    position. The hash covers the stones, the side to move, the ko
+    square, passes and prisoners, so positions that differ in any of
+    them have their own node. Nodes are arena indices, 0 is none.
+
+    The table is split in shards with their own lock. The search only
+    needs it when a move is tried for the first time from a node.
+*/
+class TranspositionTable {
+public:
+    static constexpr auto NONE = std::uint32_t{0};
+
+    // Returns the node of the position, or NONE.
+    std::uint32_t find(std::uint64_t hash);
+
+    // Returns the node of the position, which is node unless another
+    // thread inserted one first.
+    std::uint32_t insert(std::uint64_t hash, std::uint32_t node);
+
+    // Replaces every node by new_index(node), used after the nodes
+    // were moved. Entries for which it returns NONE are removed.
+    // Nobody may be using the table.
+    void remap(const std::function<std::uint32_t(std::uint32_t)>& new_index);
+
+private:
+    static constexpr auto NUM_SHARDS = 256;
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::uint64_t, std::uint32_t> nodes;
+    };
+
+    Shard& get_shard(std::uint64_t hash) {
+        // The low bits go to the buckets of the map.
+        return m_shards[(hash >> 56) % NUM_SHARDS];
+    }
+
+    std::array<Shard, NUM_SHARDS> m_shards;
+};
+
+#endif
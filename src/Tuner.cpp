@@ -19,8 +19,12 @@
 #include "config.h"
 
 #ifdef USE_OPENCL
+#include <algorithm>
 #include <array>
 #include <cassert>
+#include <cstdint>
+#include <deque>
+#include <future>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -47,6 +51,8 @@
 
 const auto TUNER_FILE_LOCAL = std::string("leelaz_opencl_tuning");
 constexpr auto MAX_ERROR = 1e-4f;
+// Half precision storage rounds the inputs and outputs of the SGEMM
+constexpr auto MAX_ERROR_HALF = 1e-2f;
 
 using namespace Utils;
 
@@ -258,15 +264,17 @@ std::string Tuner::tune_sgemm(const int m, const int n, const int k,
 
     sgemmBatched_ref(at, b, c_ref, m, n, k, batch_size);
 
+    const auto storage_size = m_opencl.storage_size();
+    const auto max_error_allowed = m_opencl.m_half ? MAX_ERROR_HALF : MAX_ERROR;
     auto aBuffer = cl::Buffer(
         m_context,
-        CL_MEM_READ_WRITE, sizeof(float) * at_size, nullptr, nullptr);
+        CL_MEM_READ_WRITE, storage_size * at_size, nullptr, nullptr);
     auto bBuffer = cl::Buffer(
         m_context,
-        CL_MEM_READ_WRITE, sizeof(float) * b_size, nullptr, nullptr);
+        CL_MEM_READ_WRITE, storage_size * b_size, nullptr, nullptr);
     auto cBuffer = cl::Buffer(
         m_context,
-        CL_MEM_READ_WRITE, sizeof(float) * c_size, nullptr, nullptr);
+        CL_MEM_READ_WRITE, storage_size * c_size, nullptr, nullptr);
 
     myprintf("\nStarted OpenCL SGEMM tuner.\n");
 
@@ -299,7 +307,53 @@ std::string Tuner::tune_sgemm(const int m, const int n, const int k,
                                   m_device,
                                   CL_QUEUE_PROFILING_ENABLE);
     auto event = cl::Event();
-    auto program = cl::Program(m_context, sourceCode_sgemm);
+
+    // Blocking transfers, converting from and to half if needed.
+    auto half_data = std::vector<std::uint16_t>{};
+    auto write_buffer = [&](cl::Buffer& buffer, std::vector<float>& data) {
+        if (m_opencl.m_half) {
+            half_data.resize(data.size());
+            std::transform(begin(data), end(data), begin(half_data),
+                           float_to_half);
+            queue.enqueueWriteBuffer(buffer, CL_TRUE, 0,
+                                     data.size() * storage_size,
+                                     half_data.data());
+        } else {
+            queue.enqueueWriteBuffer(buffer, CL_TRUE, 0,
+                                     data.size() * storage_size, data.data());
+        }
+    };
+    auto read_buffer = [&](cl::Buffer& buffer, std::vector<float>& data) {
+        if (m_opencl.m_half) {
+            half_data.resize(data.size());
+            queue.enqueueReadBuffer(buffer, CL_TRUE, 0,
+                                    data.size() * storage_size,
+                                    half_data.data());
+            std::transform(begin(half_data), end(half_data), begin(data),
+                           half_to_float);
+        } else {
+            queue.enqueueReadBuffer(buffer, CL_TRUE, 0,
+                                    data.size() * storage_size, data.data());
+        }
+    };
+
+    // Compiling takes longer than timing, so the thread pool compiles
+    // the next candidates while the current one runs on the device.
+    // Captures by value, pending builds may outlive this function.
+    auto build = [context = m_context,
+                  cl_args = m_opencl.m_cl_args](const std::string defines) {
+        try {
+            auto program = cl::Program(context, sourceCode_sgemm);
+            auto args = cl_args + " " + defines;
+            program.build(args.c_str());
+            return program;
+        } catch (const cl::Error&) {
+            return cl::Program();
+        }
+    };
+    const auto max_builds = size_t(2 * cfg_num_threads);
+    auto builds = std::deque<std::future<cl::Program>>{};
+    auto next_build = size_t{0};
 
     auto m_ceil_prev = 0;
     auto n_ceil_prev = 0;
@@ -309,13 +363,20 @@ std::string Tuner::tune_sgemm(const int m, const int n, const int k,
     for (const auto& i : valid_params) {
         param_counter++;
 
+        while (next_build < valid_params.size()
+               && builds.size() < max_builds) {
+            auto next = get_parameters_by_int(opts, valid_params[next_build]);
+            builds.emplace_back(
+                thread_pool.add_task(build, parameters_to_defines(next)));
+            next_build++;
+        }
+
         auto p = get_parameters_by_int(opts, i);
         auto defines = parameters_to_defines(p);
 
-        try {
-            auto args = m_opencl.m_cl_args + " " + defines;
-            program.build(args.c_str());
-        } catch (const cl::Error&) {
+        auto program = builds.front().get();
+        builds.pop_front();
+        if (program() == nullptr) {
             // Failed to compile, get next parameter
             continue;
         }
@@ -336,11 +397,8 @@ std::string Tuner::tune_sgemm(const int m, const int n, const int k,
             sgemm_generate_data(at, k, m, batch_size, k_ceil, m_ceil);
             sgemm_generate_data(b, n, k, batch_size, n_ceil, k_ceil);
 
-            queue.enqueueWriteBuffer(aBuffer, CL_FALSE, 0,
-                                     at_size * sizeof(float), at.data());
-            queue.enqueueWriteBuffer(bBuffer, CL_FALSE, 0,
-                                     b_size * sizeof(float), b.data());
-            queue.finish();
+            write_buffer(aBuffer, at);
+            write_buffer(bBuffer, b);
         }
 
         sgemm_kernel.setArg(0, m_ceil);
@@ -367,9 +425,7 @@ std::string Tuner::tune_sgemm(const int m, const int n, const int k,
                 queue.finish();
                 event.wait();
 
-                queue.enqueueReadBuffer(cBuffer, CL_FALSE, 0,
-                                        c_size * sizeof(float), c.data());
-                queue.finish();
+                read_buffer(cBuffer, c);
 
                 auto this_error = compare_ref(c, c_ref, n, m, batch_size,
                                               n_ceil, m_ceil);
@@ -382,11 +438,12 @@ std::string Tuner::tune_sgemm(const int m, const int n, const int k,
                 sum += elapsed;
             } catch (const cl::Error&) {
                 // Failed to enqueue kernel. Set error to max.
-                max_error = MAX_ERROR;
+                max_error = max_error_allowed;
                 break;
             }
         }
-        if (max_error < MAX_ERROR && (best_time == 0 || sum < best_time)) {
+        if (max_error < max_error_allowed
+            && (best_time == 0 || sum < best_time)) {
             auto param_str = parameters_to_string(p);
             auto kernel_ms = 1e-6f * (sum / runs);
             // Timing is in nanoseconds (10^-9), Giga = 10^9, so this works out
@@ -405,8 +462,9 @@ std::string Tuner::tune_sgemm(const int m, const int n, const int k,
     return best_params;
 }
 
-void Tuner::store_sgemm_tuners(const int m, const int n, const int k,
-                               const int batch_size, std::string tuners) {
+void Tuner::store_tuners(const std::string& kernel,
+                         const int m, const int n, const int k,
+                         const int batch_size, std::string tuners) {
     auto file_contents = std::vector<std::string>();
     {
         // Read the previous contents to string
@@ -424,8 +482,8 @@ void Tuner::store_sgemm_tuners(const int m, const int n, const int k,
     auto tuning_params = std::stringstream{};
     tuning_params << m << ";" << n << ";" << k << ";" << batch_size;
 
-    auto tuning_line_prefix = std::to_string(TUNER_VERSION) + ";XgemmBatched;"
-        + tuning_params.str() + ";";
+    auto tuning_line_prefix = std::to_string(TUNER_VERSION) + ";" + kernel
+        + ";" + tuning_params.str() + ";";
     auto tuning_line = tuning_line_prefix + tuners + ";" + device_name;
 
     // Write back previous data as long as it's not the device and
@@ -447,9 +505,10 @@ void Tuner::store_sgemm_tuners(const int m, const int n, const int k,
     }
 }
 
-std::string Tuner::sgemm_tuners_from_line(std::string line,
-                                          const int m, const int n, const int k,
-                                          const int batch_size) {
+std::string Tuner::tuners_from_line(std::string line,
+                                    const std::string& kernel,
+                                    const int m, const int n, const int k,
+                                    const int batch_size) {
     auto s = std::vector<std::string>{};
     auto ss = std::stringstream{line};
     auto item = std::string{};
@@ -466,7 +525,7 @@ std::string Tuner::sgemm_tuners_from_line(std::string line,
         return "";
     }
 
-    if (s[1] != "XgemmBatched") {
+    if (s[1] != kernel) {
         return "";
     }
 
@@ -493,21 +552,222 @@ std::string Tuner::sgemm_tuners_from_line(std::string line,
     return s[6];
 }
 
-std::string Tuner::load_sgemm_tuners(const int m, const int n, const int k,
-                                     const int batch_size) {
+std::string Tuner::load_tuners(const std::string& kernel,
+                               const int m, const int n, const int k,
+                               const int batch_size) {
     auto file = std::ifstream{TUNER_FILE_LOCAL};
     if (!cfg_sgemm_exhaustive && file.good()) {
         auto line = std::string{};
         while (std::getline(file, line)) {
-            auto tuners = sgemm_tuners_from_line(line, m, n, k, batch_size);
+            auto tuners = tuners_from_line(line, kernel, m, n, k, batch_size);
             if (tuners.size() != 0) {
-                myprintf("Loaded existing SGEMM tuning.\n");
                 return tuners;
             }
         }
     }
-    auto tuners = tune_sgemm(m, n, k, batch_size);
-    store_sgemm_tuners(m, n, k, batch_size, tuners);
+    return "";
+}
+
+std::string Tuner::load_sgemm_tuners(const int m, const int n, const int k,
+                                     const int batch_size) {
+    const auto kernel = std::string{
+        m_opencl.m_half ? "XgemmBatchedHalf" : "XgemmBatched"};
+    auto tuners = load_tuners(kernel, m, n, k, batch_size);
+    if (tuners.size() != 0) {
+        myprintf("Loaded existing SGEMM tuning.\n");
+        return tuners;
+    }
+    tuners = tune_sgemm(m, n, k, batch_size);
+    store_tuners(kernel, m, n, k, batch_size, tuners);
+    return tuners;
+}
+
+std::string Tuner::tune_transforms(const int channels, const int batch_size,
+                                   const int runs) {
+    constexpr auto tiles = WINOGRAD_P;
+    constexpr auto board_squares = 19 * 19;
+    const auto& sgemm = m_opencl.m_sgemm_tuners;
+    const auto max_wg_size = m_opencl.m_max_workgroup_size;
+    const auto local_mem_size = m_device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+
+    const auto wgs = ceilMultiple(tiles, m_opencl.m_wavefront_size);
+    const auto m_ceil = int(ceilMultiple(ceilMultiple(channels, sgemm.mwg),
+                                         sgemm.vwm));
+    const auto n_ceil = int(ceilMultiple(ceilMultiple(tiles * batch_size,
+                                                      sgemm.nwg), sgemm.vwn));
+    const auto k_ceil = int(ceilMultiple(ceilMultiple(channels, sgemm.kwg),
+                                         sgemm.vwm));
+
+    // Contents don't matter for timing, but keep them finite.
+    const auto in_size = batch_size * channels * board_squares;
+    const auto vm_size = WINOGRAD_TILE * std::max(m_ceil, k_ceil) * n_ceil;
+    auto zeros = std::vector<float>(std::max(in_size, vm_size));
+    auto make_buffer = [this, &zeros](const size_t size) {
+        return cl::Buffer(m_context,
+                          CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                          size, zeros.data());
+    };
+    const auto storage_size = m_opencl.storage_size();
+    auto inBuffer = make_buffer(in_size * storage_size);
+    auto outBuffer = make_buffer(in_size * storage_size);
+    auto VBuffer = make_buffer(vm_size * storage_size);
+    auto MBuffer = make_buffer(vm_size * storage_size);
+    auto bnBuffer = make_buffer(channels * storage_size);
+
+    auto queue = cl::CommandQueue(m_context,
+                                  m_device,
+                                  CL_QUEUE_PROFILING_ENABLE);
+
+    // Average time in nanoseconds, 0 if the configuration can't run.
+    auto time_kernel = [&queue, runs](cl::Kernel& kernel,
+                                      const cl::NDRange& global,
+                                      const cl::NDRange& local) {
+        auto event = cl::Event();
+        auto sum = 0.0;
+        try {
+            for (auto r = 0; r < runs; r++) {
+                queue.enqueueNDRangeKernel(kernel, cl::NullRange,
+                                           global, local, nullptr, &event);
+                queue.finish();
+                sum += event.getProfilingInfo<CL_PROFILING_COMMAND_END>() -
+                       event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+            }
+        } catch (const cl::Error&) {
+            return 0.0;
+        }
+        return sum / runs;
+    };
+
+    // Workgroups along the tiles of a board must divide the tile range,
+    // 0 leaves the workgroup size to the driver.
+    auto tile_sizes = std::vector<size_t>{};
+    for (auto size = size_t{1}; size <= wgs; size *= 2) {
+        if (wgs % size == 0) {
+            tile_sizes.emplace_back(size);
+        }
+    }
+    const auto channel_sizes = std::vector<size_t>{1, 2, 4, 8, 16, 32};
+
+    myprintf("Started OpenCL transform tuner.\n");
+
+    Parameters best;
+
+    auto in_transform = cl::Kernel(m_opencl.m_program, "in_transform");
+    in_transform.setArg(0, inBuffer);
+    in_transform.setArg(1, VBuffer);
+    in_transform.setArg(2, channels);
+    in_transform.setArg(3, k_ceil);
+    in_transform.setArg(4, n_ceil);
+    auto best_time = time_kernel(in_transform,
+                                 cl::NDRange(wgs, channels, batch_size),
+                                 cl::NullRange);
+    best["IN_LX"] = 0;
+    best["IN_LY"] = 0;
+    for (const auto lx : tile_sizes) {
+        for (const auto ly : channel_sizes) {
+            if (lx * ly > max_wg_size) {
+                continue;
+            }
+            const auto time = time_kernel(
+                in_transform,
+                cl::NDRange(wgs, ceilMultiple(channels, ly), batch_size),
+                cl::NDRange(lx, ly, 1));
+            if (time > 0.0 && (best_time == 0.0 || time < best_time)) {
+                best_time = time;
+                best["IN_LX"] = lx;
+                best["IN_LY"] = ly;
+            }
+        }
+    }
+    myprintf("in_transform: %zux%zu %.4f ms\n",
+             best["IN_LX"], best["IN_LY"], 1e-6 * best_time);
+
+    auto out_transform = cl::Kernel(m_opencl.m_program,
+                                    "out_transform_fused_bn");
+    out_transform.setArg(0, MBuffer);
+    out_transform.setArg(1, outBuffer);
+    out_transform.setArg(2, channels);
+    out_transform.setArg(3, m_ceil);
+    out_transform.setArg(4, n_ceil);
+    out_transform.setArg(5, inBuffer);
+    out_transform.setArg(6, bnBuffer);
+    out_transform.setArg(7, bnBuffer);
+    best_time = time_kernel(out_transform,
+                            cl::NDRange(channels, wgs, batch_size),
+                            cl::NullRange);
+    best["OUT_LX"] = 0;
+    best["OUT_LY"] = 0;
+    for (const auto lx : channel_sizes) {
+        for (const auto ly : tile_sizes) {
+            if (lx * ly > max_wg_size) {
+                continue;
+            }
+            const auto time = time_kernel(
+                out_transform,
+                cl::NDRange(ceilMultiple(channels, lx), wgs, batch_size),
+                cl::NDRange(lx, ly, 1));
+            if (time > 0.0 && (best_time == 0.0 || time < best_time)) {
+                best_time = time;
+                best["OUT_LX"] = lx;
+                best["OUT_LY"] = ly;
+            }
+        }
+    }
+    myprintf("out_transform_fused_bn: %zux%zu %.4f ms\n",
+             best["OUT_LX"], best["OUT_LY"], 1e-6 * best_time);
+
+    // A workgroup transforms whole boards, through local memory.
+    auto out_in_transform = cl::Kernel(m_opencl.m_program,
+                                       "out_transform_fused_bn_in");
+    out_in_transform.setArg(0, MBuffer);
+    out_in_transform.setArg(1, outBuffer);
+    out_in_transform.setArg(2, VBuffer);
+    out_in_transform.setArg(3, channels);
+    out_in_transform.setArg(4, m_ceil);
+    out_in_transform.setArg(5, n_ceil);
+    out_in_transform.setArg(6, k_ceil);
+    out_in_transform.setArg(7, inBuffer);
+    out_in_transform.setArg(8, bnBuffer);
+    out_in_transform.setArg(9, bnBuffer);
+    best_time = 0.0;
+    best["OUTIN_LX"] = 0;
+    for (const auto lx : channel_sizes) {
+        const auto local_size = lx * board_squares * sizeof(float);
+        if (lx * wgs > max_wg_size || local_size > local_mem_size) {
+            continue;
+        }
+        out_in_transform.setArg(10, cl::Local(local_size));
+        const auto time = time_kernel(
+            out_in_transform,
+            cl::NDRange(ceilMultiple(channels, lx), wgs, batch_size),
+            cl::NDRange(lx, wgs, 1));
+        if (time > 0.0 && (best_time == 0.0 || time < best_time)) {
+            best_time = time;
+            best["OUTIN_LX"] = lx;
+        }
+    }
+    if (best_time == 0.0) {
+        printf("Failed to find a working configuration.\nCheck your OpenCL drivers.\n");
+        throw std::runtime_error("Tuner failed to find working configuration.");
+    }
+    myprintf("out_transform_fused_bn_in: %zux%zu %.4f ms\n",
+             best["OUTIN_LX"], wgs, 1e-6 * best_time);
+
+    return parameters_to_defines(best);
+}
+
+std::string Tuner::load_transform_tuners(const int channels,
+                                         const int batch_size) {
+    const auto kernel = std::string{
+        m_opencl.m_half ? "TransformsHalf" : "Transforms"};
+    auto tuners = load_tuners(kernel, channels, WINOGRAD_P, channels,
+                              batch_size);
+    if (tuners.size() != 0) {
+        myprintf("Loaded existing transform tuning.\n");
+        return tuners;
+    }
+    tuners = tune_transforms(channels, batch_size);
+    store_tuners(kernel, channels, WINOGRAD_P, channels, batch_size, tuners);
     return tuners;
 }
 
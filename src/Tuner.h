@@ -38,21 +38,32 @@ public:
                            const int batch_size, const int runs = 4);
     std::string load_sgemm_tuners(const int m, const int n, const int k,
                                   const int batch_size);
+    // Workgroup sizes of the Winograd transform kernels. Needs the
+    // kernels built with the SGEMM tuning, which sets their padding.
+    std::string tune_transforms(const int channels, const int batch_size,
+                                const int runs = 4);
+    std::string load_transform_tuners(const int channels,
+                                      const int batch_size);
 
     static constexpr auto TUNER_VERSION = 0;
     Tuner(OpenCL & opencl, cl::Context context, cl::Device device) :
         m_opencl(opencl), m_context(context), m_device(device) {}
 private:
-    void store_sgemm_tuners(const int m, const int n, const int k,
-                            const int batch_size, std::string tuners);
+    void store_tuners(const std::string& kernel,
+                      const int m, const int n, const int k,
+                      const int batch_size, std::string tuners);
+    std::string load_tuners(const std::string& kernel,
+                            const int m, const int n, const int k,
+                            const int batch_size);
     bool valid_config_sgemm(Parameters p, bool exhaustive);
     std::string parameters_to_defines(const Parameters& p);
     std::string parameters_to_string(const Parameters& p);
     Parameters get_parameters_by_int(const std::vector<Configurations>& opts,
                                      const int n);
-    std::string sgemm_tuners_from_line(std::string line, const int m,
-                                       const int n, const int k,
-                                       const int batch_size);
+    std::string tuners_from_line(std::string line,
+                                 const std::string& kernel,
+                                 const int m, const int n, const int k,
+                                 const int batch_size);
 };
 
 #endif
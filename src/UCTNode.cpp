@@ -22,10 +22,12 @@
 #include <cstdio>
 #include <cstdint>
 #include <algorithm>
+#include <array>
 #include <cmath>
 #include <functional>
 #include <iterator>
 #include <limits>
+#include <new>
 #include <numeric>
 #include <random>
 #include <utility>
@@ -44,46 +46,119 @@
 
 using namespace Utils;
 
-UCTNode::UCTNode(int vertex, float score, float init_eval)
-    : m_move(vertex), m_score(score), m_init_eval(init_eval) {
+// Room for all moves of the largest board and a pass
+constexpr auto MAX_CHILDREN =
+    FastBoard::MAXBOARDSIZE * FastBoard::MAXBOARDSIZE + 1;
+
+UCTEdge::UCTEdge(ChildBlock children, int index)
+    : m_children(children), m_index(index) {
 }
 
-bool UCTNode::first_visit() const {
-    return m_visits == 0;
+int UCTEdge::get_move() const {
+    return m_children.moves()[m_index];
+}
+
+float UCTEdge::get_score() const {
+    return half_to_float(m_children.priors()[m_index]);
+}
+
+void UCTEdge::set_score(float score) {
+    m_children.priors()[m_index] = float_to_half(score);
+}
+
+UCTNode* UCTEdge::get_node() const {
+    const auto node =
+        m_children.nodes()[m_index].load(std::memory_order_acquire);
+    if (node == NodeArena::NONE) {
+        return nullptr;
+    }
+    return NodeArena::get(node);
+}
+
+bool UCTEdge::set_node(std::uint32_t node) {
+    auto none = NodeArena::NONE;
+    return m_children.nodes()[m_index].compare_exchange_strong(
+        none, node, std::memory_order_acq_rel);
 }
 
-SMP::Mutex& UCTNode::get_mutex() {
-    return m_nodemutex;
+bool UCTEdge::first_visit() const {
+    return get_visits() == 0;
+}
+
+int UCTEdge::get_visits() const {
+    return m_children.visits()[m_index];
+}
+
+void UCTEdge::add_visit() {
+    m_children.visits()[m_index]++;
+    m_children.visit_sum()++;
+}
+
+float UCTEdge::get_eval(int tomove) const {
+    const auto node = get_node();
+    assert(node != nullptr);
+    return node->get_eval(tomove);
+}
+
+bool UCTEdge::valid() const {
+    const auto node = get_node();
+    return node == nullptr || node->valid();
+}
+
+UCTNode::UCTNode(float init_eval)
+    : m_init_eval(init_eval) {
+}
+
+UCTNode::UCTNode(UCTNode&& other)
+    : m_virtual_loss(other.m_virtual_loss.load()),
+      m_child_count(other.m_child_count),
+      m_visits(other.m_visits.load()),
+      m_init_eval(other.m_init_eval),
+      m_net_eval(other.m_net_eval),
+      m_blackevals(other.m_blackevals.load()),
+      m_valid(other.m_valid.load()),
+      m_is_expanding(other.m_is_expanding.load()),
+      m_has_children(other.m_has_children.load()),
+      m_children(other.m_children) {
+}
+
+bool UCTNode::first_visit() const {
+    return m_visits == 0;
 }
 
 bool UCTNode::create_children(std::atomic<int> & nodecount,
+                              TreeArena & arena,
                               GameState & state,
                               float & eval) {
+    if (!acquire_expansion(state)) {
+        return false;
+    }
+
+    const auto raw_netlist = Network::get_scored_moves(
+        &state, Network::Ensemble::RANDOM_ROTATION);
+
+    eval = expand(nodecount, arena, state, raw_netlist);
+    return true;
+}
+
+bool UCTNode::acquire_expansion(const GameState & state) {
     // check whether somebody beat us to it (atomic)
     if (has_children()) {
         return false;
     }
-    // acquire the lock
-    LOCK(get_mutex(), lock);
     // no successors in final state
     if (state.get_passes() >= 2) {
         return false;
     }
-    // check whether somebody beat us to it (after taking the lock)
-    if (has_children()) {
-        return false;
-    }
-    // Someone else is running the expansion
-    if (m_is_expanding) {
-        return false;
-    }
-    // We'll be the one queueing this node for expansion, stop others
-    m_is_expanding = true;
-    lock.unlock();
-
-    const auto raw_netlist = Network::get_scored_moves(
-        &state, Network::Ensemble::RANDOM_ROTATION);
+    // We'll be the one queueing this node for expansion, stop others,
+    // unless someone else is running or has run the expansion.
+    return !m_is_expanding.exchange(true);
+}
 
+float UCTNode::expand(std::atomic<int> & nodecount,
+                      TreeArena & arena,
+                      GameState & state,
+                      const Network::Netresult & raw_netlist) {
     // DCNN returns winrate as side to move
     auto net_eval = raw_netlist.second;
     const auto to_move = state.board.get_to_move();
@@ -91,7 +166,6 @@ bool UCTNode::create_children(std::atomic<int> & nodecount,
     if (state.board.white_to_move()) {
         net_eval = 1.0f - net_eval;
     }
-    eval = net_eval;
 
     std::vector<Network::scored_node> nodelist;
 
@@ -112,11 +186,12 @@ bool UCTNode::create_children(std::atomic<int> & nodecount,
         }
     }
 
-    link_nodelist(nodecount, nodelist, net_eval);
-    return true;
+    link_nodelist(nodecount, arena, nodelist, net_eval);
+    return net_eval;
 }
 
 void UCTNode::link_nodelist(std::atomic<int> & nodecount,
+                            TreeArena & arena,
                             std::vector<Network::scored_node> & nodelist,
                             float init_eval) {
     if (nodelist.empty()) {
@@ -126,39 +201,46 @@ void UCTNode::link_nodelist(std::atomic<int> & nodecount,
     // Use best to worst order, so highest go first
     std::stable_sort(rbegin(nodelist), rend(nodelist));
 
-    LOCK(get_mutex(), lock);
-
-    m_children.reserve(nodelist.size());
-    for (const auto& node : nodelist) {
-        m_children.emplace_back(
-            std::make_unique<UCTNode>(node.second, node.first, init_eval)
-        );
+    const auto count = nodelist.size();
+    assert(count <= MAX_CHILDREN);
+    const auto index = allocate_children(arena, count);
+    const auto children = ChildBlock(ChildArena::get(index));
+    for (auto i = size_t{0}; i < count; i++) {
+        children.priors()[i] = float_to_half(nodelist[i].first);
+        children.moves()[i] = static_cast<std::int16_t>(nodelist[i].second);
     }
 
-    nodecount += m_children.size();
-    m_has_children = true;
+    // Only the thread that acquired the expansion gets here. Readers
+    // look at the children once they see m_has_children.
+    m_net_eval = init_eval;
+    m_children = index;
+    m_child_count = static_cast<std::uint16_t>(count);
+
+    nodecount += count;
+    m_has_children.store(true, std::memory_order_release);
 }
 
 void UCTNode::kill_superkos(const KoState& state) {
-    for (auto& child : m_children) {
-        auto move = child->get_move();
+    const auto is_superko = [&state](const UCTEdge& child) {
+        auto move = child.get_move();
         if (move != FastBoard::PASS) {
             KoState mystate = state;
             mystate.play_move(move);
-
-            if (mystate.superko()) {
-                // Don't delete nodes for now, just mark them invalid.
-                child->invalidate();
-            }
+            return mystate.superko();
+        }
+        return false;
+    };
+
+    // The removed children and their nodes stay in the arena until it
+    // is released.
+    const auto children = get_block();
+    auto order = std::vector<int>{};
+    for (auto i = 0; i < m_child_count; i++) {
+        if (!is_superko(UCTEdge(children, i))) {
+            order.emplace_back(i);
         }
     }
-
-    // Now do the actual deletion.
-    m_children.erase(
-        std::remove_if(begin(m_children), end(m_children),
-                       [](const auto &child) { return !child->valid(); }),
-        end(m_children)
-    );
+    reorder_children(order);
 }
 
 float UCTNode::eval_state(GameState& state) {
@@ -177,7 +259,8 @@ float UCTNode::eval_state(GameState& state) {
 }
 
 void UCTNode::dirichlet_noise(float epsilon, float alpha) {
-    auto child_cnt = m_children.size();
+    const auto children = get_children();
+    auto child_cnt = size_t{m_child_count};
 
     auto dirichlet_vector = std::vector<float>{};
     std::gamma_distribution<float> gamma(alpha, 1.0f);
@@ -199,19 +282,20 @@ void UCTNode::dirichlet_noise(float epsilon, float alpha) {
     }
 
     child_cnt = 0;
-    for (auto& child : m_children) {
-        auto score = child->get_score();
+    for (auto child : children) {
+        auto score = child.get_score();
         auto eta_a = dirichlet_vector[child_cnt++];
         score = score * (1 - epsilon) + epsilon * eta_a;
-        child->set_score(score);
+        child.set_score(score);
     }
 }
 
 void UCTNode::randomize_first_proportionally() {
     auto accum = std::uint32_t{0};
     auto accum_vector = std::vector<decltype(accum)>{};
-    for (const auto& child : m_children) {
-        accum += child->get_visits();
+    const auto children = get_children();
+    for (const auto& child : children) {
+        accum += child.get_visits();
         accum_vector.emplace_back(accum);
     }
 
@@ -229,14 +313,13 @@ void UCTNode::randomize_first_proportionally() {
         return;
     }
 
-    assert(m_children.size() >= index);
+    assert(m_child_count >= index);
 
     // Now swap the child at index with the first child
-    std::iter_swap(begin(m_children), begin(m_children) + index);
-}
-
-int UCTNode::get_move() const {
-    return m_move;
+    auto order = std::vector<int>(m_child_count);
+    std::iota(begin(order), end(order), 0);
+    std::swap(order[0], order[index]);
+    reorder_children(order);
 }
 
 void UCTNode::virtual_loss() {
@@ -260,14 +343,6 @@ void UCTNode::set_visits(int visits) {
     m_visits = visits;
 }
 
-float UCTNode::get_score() const {
-    return m_score;
-}
-
-void UCTNode::set_score(float score) {
-    m_score = score;
-}
-
 int UCTNode::get_visits() const {
     return m_visits;
 }
@@ -312,110 +387,240 @@ void UCTNode::accumulate_eval(float eval) {
     atomic_add(m_blackevals, (double)eval);
 }
 
-UCTNode* UCTNode::uct_select_child(int color) {
-    UCTNode* best = nullptr;
-    auto best_value = -1000.0f;
-
-    LOCK(get_mutex(), lock);
-
-    // Count parentvisits.
-    // We do this manually to avoid issues with transpositions.
-    auto parentvisits = size_t{0};
-    for (const auto& child : m_children) {
-        if (child->valid()) {
-            parentvisits += child->get_visits();
+UCTNode* UCTNode::get_child_node(UCTEdge edge, TreeArena& arena,
+                                 std::uint64_t hash) {
+    const auto node = edge.get_node();
+    if (node != nullptr) {
+        return node;
+    }
+    auto index = NodeArena::NONE;
+    if (arena.positions) {
+        index = arena.positions->find(hash);
+    }
+    if (index == NodeArena::NONE) {
+        index = arena.nodes.allocate(1);
+        new (NodeArena::get(index)) UCTNode(m_net_eval);
+        if (arena.positions) {
+            // Another move order may have reached the position first.
+            index = arena.positions->insert(hash, index);
+        }
+    }
+    // If another thread was first, our node stays unused in the arena.
+    edge.set_node(index);
+    return edge.get_node();
+}
+
+void UCTNode::invalidate_child(UCTEdge edge, TreeArena& arena) {
+    assert(!arena.positions);
+    const auto index = arena.nodes.allocate(1);
+    const auto node = new (NodeArena::get(index)) UCTNode(m_net_eval);
+    node->invalidate();
+    edge.set_node(index);
+}
+
+void UCTNode::create_child_nodes(TreeArena& arena, const FastState& state) {
+    for (auto child : get_children()) {
+        auto hash = std::uint64_t{0};
+        if (arena.positions && child.get_node() == nullptr) {
+            auto childstate = state;
+            childstate.play_move(child.get_move());
+            hash = childstate.board.get_hash();
         }
+        get_child_node(child, arena, hash);
     }
+}
+
+UCTEdge UCTNode::uct_select_child(int color,
+                                  const std::vector<int>& skipped) {
+    const auto children = get_block();
+    const auto count = size_t{m_child_count};
+    assert(count > 0 && count <= MAX_CHILDREN);
+
+    const auto parentvisits = children.visit_sum().load();
     auto numerator = static_cast<float>(std::sqrt((double)parentvisits));
 
-    for (const auto& child : m_children) {
-        if (!child->valid()) {
+    // First play urgency of the children without a node
+    auto fpu_eval = (color == FastBoard::WHITE ? 1.0f - m_net_eval
+                                               : m_net_eval);
+    fpu_eval -= cfg_fpu_reduction;
+
+    // Only the children that have a node need a look at it. The rest
+    // of the work goes over plain arrays, so that it vectorizes.
+    std::array<float, MAX_CHILDREN> winrates;
+    std::array<float, MAX_CHILDREN> visits;
+    const auto nodes = children.nodes();
+    const auto child_visits = children.visits();
+    for (auto i = size_t{0}; i < count; i++) {
+        visits[i] = static_cast<float>(
+            child_visits[i].load(std::memory_order_relaxed));
+        const auto index = nodes[i].load(std::memory_order_acquire);
+        if (index == NodeArena::NONE) {
+            winrates[i] = fpu_eval;
             continue;
         }
+        const auto node = NodeArena::get(index);
+        // get_eval() will automatically set first-play-urgency too,
+        // invalid children are never picked.
+        winrates[i] = node->valid() ? node->get_eval(color)
+                                    : std::numeric_limits<float>::lowest();
+    }
+    for (const auto i : skipped) {
+        winrates[i] = std::numeric_limits<float>::lowest();
+    }
 
-        // get_eval() will automatically set first-play-urgency
-        auto winrate = child->get_eval(color);
-        auto psa = child->get_score();
-        auto denom = 1.0f + child->get_visits();
+    std::array<float, MAX_CHILDREN> values;
+    const auto priors = children.priors();
+    for (auto i = size_t{0}; i < count; i++) {
+        auto psa = finite_half_to_float(priors[i]);
+        auto denom = 1.0f + visits[i];
         auto puct = cfg_puct * psa * (numerator / denom);
-        auto value = winrate + puct;
-        assert(value > -1000.0f);
-
-        if (value > best_value) {
-            best_value = value;
-            best = child.get();
-        }
+        values[i] = winrates[i] + puct;
     }
 
-    assert(best != nullptr);
-    return best;
+    auto best_value = std::numeric_limits<float>::lowest();
+    for (auto i = size_t{0}; i < count; i++) {
+        best_value = std::max(best_value, values[i]);
+    }
+    // Only if all children are invalid
+    assert(best_value > -1000.0f);
+    if (best_value <= -1000.0f) {
+        return {};
+    }
+    const auto best =
+        std::find(begin(values), begin(values) + count, best_value);
+    return {children, static_cast<int>(best - begin(values))};
 }
 
-class NodeComp : public std::binary_function<UCTNode::node_ptr_t&,
-                                             UCTNode::node_ptr_t&, bool> {
+class NodeComp : public std::binary_function<const UCTEdge&,
+                                             const UCTEdge&, bool> {
 public:
     NodeComp(int color) : m_color(color) {};
-    bool operator()(const UCTNode::node_ptr_t& a,
-                    const UCTNode::node_ptr_t& b) {
+    bool operator()(const UCTEdge& a, const UCTEdge& b) const {
         // if visits are not same, sort on visits
-        if (a->get_visits() != b->get_visits()) {
-            return a->get_visits() < b->get_visits();
+        if (a.get_visits() != b.get_visits()) {
+            return a.get_visits() < b.get_visits();
         }
 
         // neither has visits, sort on prior score
-        if (a->get_visits() == 0) {
-            return a->get_score() < b->get_score();
+        if (a.get_visits() == 0) {
+            return a.get_score() < b.get_score();
         }
 
         // both have same non-zero number of visits
-        return a->get_eval(m_color) < b->get_eval(m_color);
+        return a.get_eval(m_color) < b.get_eval(m_color);
     }
 private:
     int m_color;
 };
 
 void UCTNode::sort_children(int color) {
-    LOCK(get_mutex(), lock);
-    std::stable_sort(begin(m_children), end(m_children), NodeComp(color));
-    std::reverse(begin(m_children), end(m_children));
+    const auto children = get_block();
+    const auto comp = NodeComp(color);
+    auto order = std::vector<int>(m_child_count);
+    std::iota(begin(order), end(order), 0);
+    std::stable_sort(begin(order), end(order), [&](int a, int b) {
+        return comp(UCTEdge(children, a), UCTEdge(children, b));
+    });
+    std::reverse(begin(order), end(order));
+    reorder_children(order);
+}
+
+UCTEdge UCTNode::get_best_root_child(int color) {
+    assert(m_child_count > 0);
+
+    // The first of the best, like std::max_element
+    const auto children = get_block();
+    auto comp = NodeComp(color);
+    auto best = 0;
+    for (auto i = 1; i < m_child_count; i++) {
+        if (comp(UCTEdge(children, best), UCTEdge(children, i))) {
+            best = i;
+        }
+    }
+    return {children, best};
 }
 
-UCTNode& UCTNode::get_best_root_child(int color) {
-    LOCK(get_mutex(), lock);
-    assert(!m_children.empty());
-
-    return *(std::max_element(begin(m_children), end(m_children),
-                              NodeComp(color))->get());
+UCTEdge UCTNode::get_first_child() const {
+    if (m_child_count == 0) {
+        return {};
+    }
+    return {get_block(), 0};
 }
 
-UCTNode* UCTNode::get_first_child() const {
-    if (m_children.empty()) {
-        return nullptr;
+UCTNode::ChildRange UCTNode::get_children() const {
+    if (m_child_count == 0) {
+        return {ChildBlock(nullptr), 0};
     }
-    return m_children.front().get();
+    return {get_block(), m_child_count};
 }
 
-const std::vector<UCTNode::node_ptr_t>& UCTNode::get_children() const {
-    return m_children;
+ChildBlock UCTNode::get_block() const {
+    return ChildBlock(ChildArena::get(m_children));
+}
+
+std::uint32_t UCTNode::allocate_children(TreeArena& arena, size_t count) {
+    const auto index =
+        arena.children.allocate(std::uint32_t(ChildBlock::words(count)));
+    const auto block = ChildArena::get(index);
+    block[1] = static_cast<std::uint32_t>(count);
+    const auto children = ChildBlock(block);
+    new (&children.visit_sum()) std::atomic<std::uint32_t>(0);
+    for (auto i = size_t{0}; i < count; i++) {
+        new (&children.visits()[i]) std::atomic<std::uint32_t>(0);
+        new (&children.nodes()[i]) std::atomic<std::uint32_t>(NodeArena::NONE);
+    }
+    return index;
+}
+
+void UCTNode::reorder_children(const std::vector<int>& order) {
+    const auto children = get_block();
+    auto visits = std::vector<std::uint32_t>{};
+    auto nodes = std::vector<std::uint32_t>{};
+    auto priors = std::vector<std::uint16_t>{};
+    auto moves = std::vector<std::int16_t>{};
+    for (const auto i : order) {
+        visits.emplace_back(children.visits()[i]);
+        nodes.emplace_back(children.nodes()[i]);
+        priors.emplace_back(children.priors()[i]);
+        moves.emplace_back(children.moves()[i]);
+    }
+
+    auto visit_sum = std::uint32_t{0};
+    for (auto i = size_t{0}; i < order.size(); i++) {
+        children.visits()[i] = visits[i];
+        children.nodes()[i] = nodes[i];
+        children.priors()[i] = priors[i];
+        children.moves()[i] = moves[i];
+        if (UCTEdge(children, int(i)).valid()) {
+            visit_sum += visits[i];
+        }
+    }
+    children.visit_sum() = visit_sum;
+    m_child_count = static_cast<std::uint16_t>(order.size());
 }
 
-size_t UCTNode::count_nodes() const {
+// Counts the edges, which take the place the child nodes had.
+size_t UCTNode::count_nodes(std::unordered_set<const UCTNode*>* seen) const {
     auto nodecount = size_t{0};
     if (m_has_children) {
-        nodecount += m_children.size();
-        for (auto& child : m_children) {
-            nodecount += child->count_nodes();
+        nodecount += m_child_count;
+        for (const auto& child : get_children()) {
+            const auto node = child.get_node();
+            if (node != nullptr
+                && (seen == nullptr || seen->insert(node).second)) {
+                nodecount += node->count_nodes(seen);
+            }
         }
     }
     return nodecount;
 }
 
 // Used to find new root in UCTSearch
-UCTNode::node_ptr_t UCTNode::find_child(const int move) {
+UCTNode* UCTNode::find_child(const int move) {
     if (m_has_children) {
-        for (auto& child : m_children) {
-            if (child->get_move() == move) {
-                return std::move(child);
+        for (const auto& child : get_children()) {
+            if (child.get_move() == move) {
+                return child.get_node();
             }
         }
     }
@@ -424,18 +629,56 @@ UCTNode::node_ptr_t UCTNode::find_child(const int move) {
     return nullptr;
 }
 
-UCTNode* UCTNode::get_nopass_child(FastState& state) const {
-    for (const auto& child : m_children) {
+void UCTNode::move_children(TreeArena& arena, moved_nodes_t* moved) {
+    if (m_child_count == 0) {
+        return;
+    }
+    const auto count = size_t{m_child_count};
+    const auto from = get_block();
+    const auto index = allocate_children(arena, count);
+    const auto to = ChildBlock(ChildArena::get(index));
+    to.visit_sum() = from.visit_sum().load();
+    for (auto i = size_t{0}; i < count; i++) {
+        to.visits()[i] = from.visits()[i].load();
+        to.priors()[i] = from.priors()[i];
+        to.moves()[i] = from.moves()[i];
+
+        const auto node = UCTEdge(from, int(i)).get_node();
+        if (node == nullptr) {
+            continue;
+        }
+        if (moved != nullptr) {
+            const auto iter = moved->find(node);
+            if (iter != moved->end()) {
+                to.nodes()[i] = iter->second;
+                continue;
+            }
+        }
+        const auto node_index = arena.nodes.allocate(1);
+        auto newnode =
+            new (NodeArena::get(node_index)) UCTNode(std::move(*node));
+        to.nodes()[i] = node_index;
+        if (moved != nullptr) {
+            moved->emplace(node, node_index);
+        }
+        newnode->move_children(arena, moved);
+    }
+    m_children = index;
+}
+
+UCTEdge UCTNode::get_nopass_child(FastState& state) const {
+    for (const auto child : get_children()) {
         /* If we prevent the engine from passing, we must bail out when
            we only have unreasonable moves to pick, like filling eyes.
            Note that this isn't knowledge isn't required by the engine,
            we require it because we're overruling its moves. */
-        if (child->m_move != FastBoard::PASS
-            && !state.board.is_eye(state.get_to_move(), child->m_move)) {
-            return child.get();
+        const auto move = child.get_move();
+        if (move != FastBoard::PASS
+            && !state.board.is_eye(state.get_to_move(), move)) {
+            return child;
         }
     }
-    return nullptr;
+    return {};
 }
 
 void UCTNode::invalidate() {
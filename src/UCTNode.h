@@ -22,13 +22,123 @@
 #include "config.h"
 
 #include <atomic>
+#include <cstdint>
 #include <limits>
 #include <memory>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include "Arena.h"
 #include "GameState.h"
 #include "Network.h"
-#include "SMP.h"
+#include "TranspositionTable.h"
+
+class UCTNode;
+using NodeArena = Arena<UCTNode>;
+// Words of the blocks of children, see ChildBlock
+using ChildArena = Arena<std::uint32_t>;
+
+// Memory of one search tree. With transpositions, the tree is a
+// graph in which all move orders that reach a position share its node.
+struct TreeArena {
+    explicit TreeArena(bool transpositions = false)
+        : positions(transpositions ? std::make_unique<TranspositionTable>()
+                                   : nullptr) {
+    }
+
+    NodeArena nodes;
+    ChildArena children;
+    // Nodes by position, only with transpositions
+    std::unique_ptr<TranspositionTable> positions;
+};
+
+/*
+    The children of a node, as arrays in one run of 32 bit words:
+
+        visit sum, capacity, visits[capacity], nodes[capacity],
+        priors[capacity], moves[capacity]
+
+    so that the selection can go over each statistic of all children
+    at once. Priors are in half precision, they and the moves take
+    half a word. The visit sum is that of the valid children, which
+    saves the selection from adding them up.
+*/
+class ChildBlock {
+public:
+    static size_t words(const size_t capacity) {
+        return 2 + 2 * capacity + 2 * ((capacity + 1) / 2);
+    }
+
+    explicit ChildBlock(std::uint32_t* const block) : m_block(block) {}
+
+    std::atomic<std::uint32_t>& visit_sum() const {
+        return *reinterpret_cast<std::atomic<std::uint32_t>*>(m_block);
+    }
+    size_t capacity() const {
+        return m_block[1];
+    }
+    std::atomic<std::uint32_t>* visits() const {
+        return reinterpret_cast<std::atomic<std::uint32_t>*>(m_block + 2);
+    }
+    std::atomic<std::uint32_t>* nodes() const {
+        return visits() + capacity();
+    }
+    std::uint16_t* priors() const {
+        return reinterpret_cast<std::uint16_t*>(m_block + 2
+                                                + 2 * capacity());
+    }
+    std::int16_t* moves() const {
+        return reinterpret_cast<std::int16_t*>(priors()
+                                               + 2 * ((capacity() + 1) / 2));
+    }
+
+private:
+    std::uint32_t* m_block;
+};
+
+/*
+    A move from a node with its prior, which refers to its place in
+    the block of children of the node. The child node is only created
+    the first time the search visits the move, most moves never get
+    one. Until then, the statistics of the child are those of an
+    unvisited node.
+
+    The visits are those through this edge. They only differ from the
+    visits of the child node when the node is shared by transpositions.
+*/
+class UCTEdge {
+public:
+    // No edge
+    UCTEdge() = default;
+    UCTEdge(ChildBlock children, int index);
+    explicit operator bool() const {
+        return m_index >= 0;
+    }
+
+    // Place among the children of the node
+    int get_index() const {
+        return m_index;
+    }
+    int get_move() const;
+    float get_score() const;
+    void set_score(float score);
+    UCTNode* get_node() const;
+    // The node of an edge is created by the parent. Returns false if
+    // another thread set one first.
+    bool set_node(std::uint32_t node);
+
+    bool first_visit() const;
+    int get_visits() const;
+    void add_visit();
+    // Only valid once the child has a node.
+    float get_eval(int tomove) const;
+    bool valid() const;
+
+private:
+    ChildBlock m_children{nullptr};
+    int m_index{-1};
+};
 
 class UCTNode {
 public:
@@ -37,23 +147,50 @@ public:
     // search tree.
     static constexpr auto VIRTUAL_LOSS_COUNT = 3;
 
-    using node_ptr_t = std::unique_ptr<UCTNode>;
+    // Goes over the edges to the children.
+    class ChildIterator {
+    public:
+        ChildIterator(ChildBlock children, int index)
+            : m_children(children), m_index(index) {}
+        UCTEdge operator*() const { return {m_children, m_index}; }
+        ChildIterator& operator++() { m_index++; return *this; }
+        bool operator!=(const ChildIterator& other) const {
+            return m_index != other.m_index;
+        }
+    private:
+        ChildBlock m_children;
+        int m_index;
+    };
 
-    explicit UCTNode(int vertex, float score, float init_eval);
+    struct ChildRange {
+        ChildBlock children;
+        int count;
+        ChildIterator begin() const { return {children, 0}; }
+        ChildIterator end() const { return {children, count}; }
+    };
+
+    explicit UCTNode(float init_eval);
     UCTNode() = delete;
     ~UCTNode() = default;
+    // Moving is only used to relocate nodes while there is no search
+    // running. The functions that reorder or remove children are only
+    // for the root in that phase too, everything else is safe to call
+    // from several threads without locking.
+    UCTNode(UCTNode&& other);
     bool first_visit() const;
     bool has_children() const;
-    bool create_children(std::atomic<int>& nodecount,
+    bool create_children(std::atomic<int>& nodecount, TreeArena& arena,
                          GameState& state, float& eval);
+    // create_children in two steps, so that the evaluation can happen
+    // elsewhere. Only the caller that acquired the expansion may expand.
+    bool acquire_expansion(const GameState& state);
+    float expand(std::atomic<int>& nodecount, TreeArena& arena,
+                 GameState& state, const Network::Netresult& raw_netlist);
     float eval_state(GameState& state);
     void kill_superkos(const KoState& state);
     void invalidate();
     bool valid() const;
-    int get_move() const;
     int get_visits() const;
-    float get_score() const;
-    void set_score(float score);
     float get_eval(int tomove) const;
     double get_blackevals() const;
     void set_visits(int visits);
@@ -65,43 +202,67 @@ public:
     void randomize_first_proportionally();
     void update(float eval = std::numeric_limits<float>::quiet_NaN());
 
-    UCTNode* uct_select_child(int color);
-    UCTNode* get_first_child() const;
-    UCTNode* get_nopass_child(FastState& state) const;
-    const std::vector<node_ptr_t>& get_children() const;
-    size_t count_nodes() const;
-    node_ptr_t find_child(const int move);
+    // Returns no edge if all children are invalid. The children at the
+    // indices in skipped are never picked.
+    UCTEdge uct_select_child(int color,
+                             const std::vector<int>& skipped = {});
+    // Returns the node of a child, creating it on the first visit.
+    // With transpositions, hash is that of the position after the
+    // move, and the node is shared with other move orders.
+    UCTNode* get_child_node(UCTEdge edge, TreeArena& arena,
+                            std::uint64_t hash);
+    // The move of the edge repeats an earlier position. Only without
+    // transpositions: in a graph, whether it does depends on the move
+    // order that reached the node.
+    void invalidate_child(UCTEdge edge, TreeArena& arena);
+    // Gives every child a node, for the code that reports on them.
+    void create_child_nodes(TreeArena& arena, const FastState& state);
+    UCTEdge get_first_child() const;
+    UCTEdge get_nopass_child(FastState& state) const;
+    ChildRange get_children() const;
+    // Counts the edges below. In a graph, seen has to be passed to
+    // count the shared nodes once.
+    size_t count_nodes(
+        std::unordered_set<const UCTNode*>* seen = nullptr) const;
+    UCTNode* find_child(const int move);
+    // Where nodes were moved to, to move shared nodes once.
+    using moved_nodes_t = std::unordered_map<const UCTNode*, std::uint32_t>;
+    // Moves the subtree below this node into another arena. In a
+    // graph, moved has to be passed.
+    void move_children(TreeArena& arena, moved_nodes_t* moved = nullptr);
     void sort_children(int color);
-    UCTNode& get_best_root_child(int color);
-    SMP::Mutex& get_mutex();
+    UCTEdge get_best_root_child(int color);
 
 private:
-    void link_nodelist(std::atomic<int>& nodecount,
+    void link_nodelist(std::atomic<int>& nodecount, TreeArena& arena,
                        std::vector<Network::scored_node>& nodelist,
                        float init_eval);
+    ChildBlock get_block() const;
+    static std::uint32_t allocate_children(TreeArena& arena, size_t count);
+    // Keeps the children at the given indices, in that order.
+    void reorder_children(const std::vector<int>& order);
     // Note : This class is very size-sensitive as we are going to create
     // tens of millions of instances of these.  Please put extra caution
     // if you want to add/remove/reorder any variables here.
 
-    // Move
-    std::int16_t m_move;
     // UCT
     std::atomic<std::int16_t> m_virtual_loss{0};
+    std::uint16_t m_child_count{0};
     std::atomic<int> m_visits{0};
     // UCT eval
-    float m_score;
     float m_init_eval;
+    // Eval of the network, the init_eval of the children
+    float m_net_eval{0.0f};
     std::atomic<double> m_blackevals{0};
     // node alive (not superko)
     std::atomic<bool> m_valid{true};
     // Is someone adding scores to this node?
     // We don't need to unset this.
-    bool m_is_expanding{false};
-    SMP::Mutex m_nodemutex;
+    std::atomic<bool> m_is_expanding{false};
 
-    // Tree data
+    // Tree data, m_has_children publishes the block of children.
     std::atomic<bool> m_has_children{false};
-    std::vector<node_ptr_t> m_children;
+    std::uint32_t m_children{ChildArena::NONE};
 };
 
 #endif
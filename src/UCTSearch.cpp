@@ -19,17 +19,25 @@
 #include "config.h"
 #include "UCTSearch.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
 #include <limits>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
 #include <type_traits>
+#include <unordered_set>
+#include <vector>
 
 #include "FastBoard.h"
 #include "FullBoard.h"
 #include "GTP.h"
 #include "GameState.h"
 #include "KoState.h"
+#include "Random.h"
 #include "ThreadPool.h"
 #include "TimeControl.h"
 #include "Timing.h"
@@ -38,11 +46,42 @@
 
 using namespace Utils;
 
+// Frees the arenas of trees that are no longer needed on a thread of
+// its own, so that the search doesn't wait for it. Constructed before
+// main, so it outlives every search, which hands it its last tree when
+// destroyed. The thread is only started on first use.
+static ThreadPool s_reclaimer;
+static std::once_flag s_reclaimer_started;
+
+static void reclaim(std::unique_ptr<TreeArena> arena) {
+    if (!arena) {
+        return;
+    }
+    std::call_once(s_reclaimer_started, [] {
+        s_reclaimer.add_thread(lower_thread_priority);
+    });
+    s_reclaimer.add_task([arena = std::move(arena)]() mutable {
+        arena.reset();
+    });
+}
+
 UCTSearch::UCTSearch(GameState& g)
     : m_rootstate(g) {
     set_playout_limit(cfg_max_playouts);
     set_visit_limit(cfg_max_visits);
-    m_root = std::make_unique<UCTNode>(FastBoard::PASS, 0.0f, 0.5f);
+    m_root = create_root();
+}
+
+UCTSearch::~UCTSearch() {
+    reclaim(std::move(m_arena));
+}
+
+// Starts a new tree. All nodes of the old one are released at once,
+// in the background.
+UCTNode* UCTSearch::create_root() {
+    reclaim(std::move(m_arena));
+    m_arena = std::make_unique<TreeArena>(cfg_transpositions);
+    return new (NodeArena::get(m_arena->nodes.allocate(1))) UCTNode(0.5f);
 }
 
 bool UCTSearch::advance_to_new_rootstate() {
@@ -100,17 +139,43 @@ void UCTSearch::update_root() {
     m_playouts = 0;
 
 #ifndef NDEBUG
-    auto start_nodes = m_root->count_nodes();
+    auto start_nodes = count_nodes();
 #endif
 
     if (!advance_to_new_rootstate() || !m_root) {
-        m_root = std::make_unique<UCTNode>(FastBoard::PASS, 0.0f, 0.5f);
+        m_root = create_root();
     }
     // Clear last_rootstate to prevent accidental use.
     m_last_rootstate.reset(nullptr);
 
     // Check how big our search tree (reused or new) is.
-    m_nodes = m_root->count_nodes();
+    m_nodes = count_nodes();
+
+    // The rest of the old tree is still in the arena. Once it takes
+    // more room than the part we kept, move that to a new arena and
+    // release the old one at once, in the background.
+    if (m_arena->children.size()
+        > 2 * ChildBlock::words(size_t(m_nodes) + 1)) {
+        auto arena = std::make_unique<TreeArena>();
+        const auto index = arena->nodes.allocate(1);
+        auto root = new (NodeArena::get(index)) UCTNode(std::move(*m_root));
+        if (m_arena->positions) {
+            // Shared nodes are moved once, and the positions table
+            // follows the nodes that are kept.
+            auto moved = UCTNode::moved_nodes_t{{m_root, index}};
+            root->move_children(*arena, &moved);
+            arena->positions = std::move(m_arena->positions);
+            arena->positions->remap([&moved](std::uint32_t node) {
+                const auto iter = moved.find(NodeArena::get(node));
+                return iter == end(moved) ? NodeArena::NONE : iter->second;
+            });
+        } else {
+            root->move_children(*arena);
+        }
+        m_root = root;
+        reclaim(std::move(m_arena));
+        m_arena = std::move(arena);
+    }
 
 #ifndef NDEBUG
     if (m_nodes > 0) {
@@ -120,9 +185,16 @@ void UCTSearch::update_root() {
 #endif
 }
 
+size_t UCTSearch::count_nodes() const {
+    if (m_arena->positions) {
+        auto seen = std::unordered_set<const UCTNode*>{};
+        return m_root->count_nodes(&seen);
+    }
+    return m_root->count_nodes();
+}
+
 SearchResult UCTSearch::play_simulation(GameState & currstate,
                                         UCTNode* const node) {
-    const auto color = currstate.get_to_move();
     auto result = SearchResult{};
 
     node->virtual_loss();
@@ -133,7 +205,7 @@ SearchResult UCTSearch::play_simulation(GameState & currstate,
             result = SearchResult::from_score(score);
         } else if (m_nodes < MAX_TREE_SIZE) {
             float eval;
-            auto success = node->create_children(m_nodes, currstate, eval);
+            auto success = node->create_children(m_nodes, *m_arena, currstate, eval);
             if (success) {
                 result = SearchResult::from_eval(eval);
             }
@@ -144,16 +216,14 @@ SearchResult UCTSearch::play_simulation(GameState & currstate,
     }
 
     if (node->has_children() && !result.valid()) {
-        auto next = node->uct_select_child(color);
-
-        if (next != nullptr) {
-            auto move = next->get_move();
-
-            currstate.play_move(move);
-            if (move != FastBoard::PASS && currstate.superko()) {
-                next->invalidate();
-            } else {
-                result = play_simulation(currstate, next);
+        auto next = play_child(node, currstate);
+
+        if (next) {
+            const auto child = node->get_child_node(
+                next, *m_arena, currstate.board.get_hash());
+            result = play_simulation(currstate, child);
+            if (result.valid()) {
+                next.add_visit();
             }
         }
     }
@@ -166,6 +236,294 @@ SearchResult UCTSearch::play_simulation(GameState & currstate,
     return result;
 }
 
+// Picks the move of a simulation from node and plays it. A move that
+// repeats an earlier position is invalid for good in a tree, and ends
+// the simulation. In a graph, that depends on the move order that
+// reached the node, so the move is only skipped by this simulation.
+// Returns no edge if the simulation ends.
+UCTEdge UCTSearch::play_child(UCTNode* const node, GameState& currstate) {
+    auto skipped = std::vector<int>{};
+    for (;;) {
+        const auto next =
+            node->uct_select_child(currstate.get_to_move(), skipped);
+        if (!next) {
+            return next;
+        }
+        const auto move = next.get_move();
+        currstate.play_move(move);
+        if (move == FastBoard::PASS || !currstate.superko()) {
+            return next;
+        }
+        if (!m_arena->positions) {
+            node->invalidate_child(next, *m_arena);
+            return {};
+        }
+        currstate.undo_move();
+        skipped.emplace_back(next.get_index());
+    }
+}
+
+// Walks down from the root under virtual loss, like play_simulation,
+// until reaching a node that needs an evaluation, and returns true.
+// Otherwise the simulation ended with result, which is invalid if it
+// ran into a node another simulation is expanding.
+bool UCTSearch::select_leaf(UCTNode* const root, PendingLeaf& leaf,
+                            SearchResult& result) {
+    auto& currstate = *leaf.state;
+    auto node = root;
+    while (true) {
+        node->virtual_loss();
+        leaf.path.emplace_back(node);
+
+        if (!node->has_children()) {
+            if (currstate.get_passes() >= 2) {
+                auto score = currstate.final_score();
+                result = SearchResult::from_score(score);
+                return false;
+            } else if (m_nodes < MAX_TREE_SIZE) {
+                if (node->acquire_expansion(currstate)) {
+                    leaf.expand = true;
+                    return true;
+                }
+            } else {
+                leaf.expand = false;
+                return true;
+            }
+        }
+
+        if (!node->has_children()) {
+            return false;
+        }
+        const auto next = play_child(node, currstate);
+        if (!next) {
+            return false;
+        }
+        leaf.edges.emplace_back(next);
+        node = node->get_child_node(next, *m_arena,
+                                    currstate.board.get_hash());
+    }
+}
+
+void UCTSearch::backup(const PendingLeaf& leaf, const SearchResult& result) {
+    for (const auto node : leaf.path) {
+        if (result.valid()) {
+            node->update(result.eval());
+        }
+        node->virtual_loss_undo();
+    }
+    if (result.valid()) {
+        for (auto edge : leaf.edges) {
+            edge.add_visit();
+        }
+    }
+}
+
+void UCTSearch::play_batch(GameState& rootstate, UCTNode* const root,
+                           const size_t batch_size,
+                           pending_batches_t& pending) {
+    // The virtual losses steer the descents to different leaves. Stop
+    // early if they keep running into each other or into the end of
+    // the game.
+    auto leaves = std::vector<leaf_ptr_t>{};
+    for (auto descents = size_t{0};
+         descents < 2 * batch_size && leaves.size() < batch_size;
+         descents++) {
+        auto leaf = std::make_unique<PendingLeaf>();
+        leaf->state = std::make_unique<GameState>(rootstate);
+        auto result = SearchResult{};
+        if (select_leaf(root, *leaf, result)) {
+            leaves.emplace_back(std::move(leaf));
+        } else {
+            backup(*leaf, result);
+            if (result.valid()) {
+                increment_playouts();
+            }
+        }
+    }
+    if (leaves.empty()) {
+        // Every walk ran into a node that waits for its evaluation.
+        if (!pending.empty()) {
+            finish_batch(pending);
+        }
+        return;
+    }
+
+    auto states = std::vector<const GameState*>{};
+    for (const auto& leaf : leaves) {
+        states.emplace_back(leaf->state.get());
+    }
+    auto batch = std::make_unique<PendingBatch>();
+    batch->eval = Network::start_batch(states);
+    batch->leaves = std::move(leaves);
+    pending.emplace_back(std::move(batch));
+
+    // The oldest batches have had the most time to be evaluated.
+    while (pending.size() >= size_t(cfg_batches_in_flight)) {
+        finish_batch(pending);
+    }
+}
+
+void UCTSearch::finish_batch(pending_batches_t& pending) {
+    auto batch = std::move(pending.front());
+    pending.pop_front();
+    resume_leaves(batch->leaves, Network::finish_batch(*batch->eval));
+}
+
+void UCTSearch::finish_simulations(pending_batches_t& pending) {
+    while (!pending.empty()) {
+        finish_batch(pending);
+    }
+}
+
+// Evaluates the leaves together, then expands and backs up each of them.
+void UCTSearch::evaluate_leaves(std::vector<leaf_ptr_t>& leaves) {
+    auto states = std::vector<const GameState*>{};
+    for (const auto& leaf : leaves) {
+        states.emplace_back(leaf->state.get());
+    }
+    resume_leaves(leaves, Network::get_scored_moves_batch(states));
+}
+
+void UCTSearch::resume_leaves(std::vector<leaf_ptr_t>& leaves,
+                              const std::vector<Network::Netresult>& netresults) {
+    for (auto i = size_t{0}; i < leaves.size(); i++) {
+        auto& leaf = *leaves[i];
+        auto eval = 0.0f;
+        if (leaf.expand) {
+            eval = leaf.path.back()->expand(m_nodes, *m_arena,
+                                            *leaf.state, netresults[i]);
+        } else {
+            // DCNN returns winrate as side to move
+            eval = netresults[i].second;
+            if (leaf.state->board.white_to_move()) {
+                eval = 1.0f - eval;
+            }
+        }
+        backup(leaf, SearchResult::from_eval(eval));
+        increment_playouts();
+    }
+}
+
+void UCTSearch::queue_simulation(GameState& rootstate, UCTNode* const root) {
+    // Running far ahead of the evaluators would only pile up virtual
+    // losses in the tree.
+    if (m_pending_leaves >= m_max_pending_leaves) {
+        std::unique_lock<std::mutex> lock(m_pipeline_mutex);
+        m_walker_cv.wait(lock, [this] {
+            return m_pending_leaves < m_max_pending_leaves;
+        });
+        return;
+    }
+
+    auto leaf = std::make_unique<PendingLeaf>();
+    leaf->state = std::make_unique<GameState>(rootstate);
+    auto result = SearchResult{};
+    if (!select_leaf(root, *leaf, result)) {
+        backup(*leaf, result);
+        if (result.valid()) {
+            increment_playouts();
+        }
+        return;
+    }
+
+    m_pending_leaves++;
+    // The queue has room for every pending leaf and a leaf from each
+    // search thread, a failure is a momentary race.
+    while (!m_leaf_queue->push(std::move(leaf))) {
+        std::this_thread::yield();
+    }
+    // Pairs with the fence in evaluator(): either we see it is idle,
+    // or it sees the leaf before going to sleep.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_idle_evaluators > 0) {
+        { std::lock_guard<std::mutex> lock(m_pipeline_mutex); }
+        m_evaluator_cv.notify_one();
+    }
+}
+
+void UCTSearch::evaluator() {
+    const auto batch_size = size_t(cfg_leaf_batch);
+    auto leaves = std::vector<leaf_ptr_t>{};
+    for (;;) {
+        // Take whatever is queued, up to a batch.
+        auto leaf = leaf_ptr_t{};
+        while (leaves.size() < batch_size && m_leaf_queue->pop(leaf)) {
+            leaves.emplace_back(std::move(leaf));
+        }
+        if (!leaves.empty()) {
+            const auto count = int(leaves.size());
+            evaluate_leaves(leaves);
+            leaves.clear();
+            m_pending_leaves -= count;
+            { std::lock_guard<std::mutex> lock(m_pipeline_mutex); }
+            m_walker_cv.notify_all();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_pipeline_mutex);
+        m_idle_evaluators++;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        m_evaluator_cv.wait(lock, [this] {
+            return !m_leaf_queue->empty() || !m_evaluating;
+        });
+        m_idle_evaluators--;
+        // The search threads are done by then, nothing can be added.
+        if (!m_evaluating && m_leaf_queue->empty()) {
+            return;
+        }
+    }
+}
+
+void UCTSearch::start_evaluators(ThreadGroup& tg) {
+    if (cfg_eval_threads == 0) {
+        return;
+    }
+    // Enough leaves to give every evaluator its next batch while it
+    // works on the current one.
+    m_max_pending_leaves = 2 * cfg_eval_threads * cfg_leaf_batch;
+    m_leaf_queue = std::make_unique<LockFreeQueue<leaf_ptr_t>>(
+        m_max_pending_leaves + cfg_num_threads);
+    m_evaluating = true;
+    for (auto i = 0; i < cfg_eval_threads; i++) {
+        tg.add_task([this]() { evaluator(); });
+    }
+}
+
+// Call after the search threads stopped, the evaluators finish the
+// leaves still queued.
+void UCTSearch::stop_evaluators(ThreadGroup& tg) {
+    {
+        std::lock_guard<std::mutex> lock(m_pipeline_mutex);
+        m_evaluating = false;
+    }
+    m_evaluator_cv.notify_all();
+    tg.wait_all();
+    assert(m_pending_leaves == 0);
+}
+
+void UCTSearch::run_simulations(GameState& rootstate, UCTNode* const root,
+                                pending_batches_t& pending) {
+    if (cfg_eval_threads > 0) {
+        queue_simulation(rootstate, root);
+        return;
+    }
+
+    // Don't run far past the playout or visit limit.
+    const auto remaining = std::min(m_maxplayouts - m_playouts,
+                                    m_maxvisits - root->get_visits());
+    const auto batch_size = std::min(cfg_leaf_batch, std::max(1, remaining));
+    if (batch_size > 1 || cfg_batches_in_flight > 1) {
+        play_batch(rootstate, root, batch_size, pending);
+        return;
+    }
+
+    auto currstate = std::make_unique<GameState>(rootstate);
+    auto result = play_simulation(*currstate, root);
+    if (result.valid()) {
+        increment_playouts();
+    }
+}
+
 void UCTSearch::dump_stats(KoState & state, UCTNode & parent) {
     if (cfg_quiet || !parent.has_children()) {
         return;
@@ -177,29 +535,29 @@ void UCTSearch::dump_stats(KoState & state, UCTNode & parent) {
     parent.sort_children(color);
 
 
-    if (parent.get_first_child()->first_visit()) {
+    if (parent.get_first_child().first_visit()) {
         return;
     }
 
     int movecount = 0;
-    for (const auto& node : parent.get_children()) {
+    for (const auto node : parent.get_children()) {
         // Always display at least two moves. In the case there is
         // only one move searched the user could get an idea why.
-        if (++movecount > 2 && !node->get_visits()) break;
+        if (++movecount > 2 && !node.get_visits()) break;
 
-        std::string tmp = state.move_to_text(node->get_move());
+        std::string tmp = state.move_to_text(node.get_move());
         std::string pvstring(tmp);
 
         myprintf("%4s -> %7d (V: %5.2f%%) (N: %5.2f%%) PV: ",
             tmp.c_str(),
-            node->get_visits(),
-            node->get_eval(color)*100.0f,
-            node->get_score() * 100.0f);
+            node.get_visits(),
+            node.get_eval(color)*100.0f,
+            node.get_score() * 100.0f);
 
         KoState tmpstate = state;
 
-        tmpstate.play_move(node->get_move());
-        pvstring += " " + get_pv(tmpstate, *node);
+        tmpstate.play_move(node.get_move());
+        pvstring += " " + get_pv(tmpstate, *node.get_node());
 
         myprintf("%s\n", pvstring.c_str());
     }
@@ -275,24 +633,24 @@ int UCTSearch::get_best_move(passflag_t passflag) {
     }
 
     auto first_child = m_root->get_first_child();
-    assert(first_child != nullptr);
+    assert(first_child);
 
-    auto bestmove = first_child->get_move();
-    auto bestscore = first_child->get_eval(color);
+    auto bestmove = first_child.get_move();
+    auto bestscore = first_child.get_eval(color);
 
     // do we want to fiddle with the best move because of the rule set?
     if (passflag & UCTSearch::NOPASS) {
         // were we going to pass?
         if (bestmove == FastBoard::PASS) {
-            UCTNode * nopass = m_root->get_nopass_child(m_rootstate);
+            auto nopass = m_root->get_nopass_child(m_rootstate);
 
-            if (nopass != nullptr) {
+            if (nopass) {
                 myprintf("Preferring not to pass.\n");
-                bestmove = nopass->get_move();
-                if (nopass->first_visit()) {
+                bestmove = nopass.get_move();
+                if (nopass.first_visit()) {
                     bestscore = 1.0f;
                 } else {
-                    bestscore = nopass->get_eval(color);
+                    bestscore = nopass.get_eval(color);
                 }
             } else {
                 myprintf("Pass is the only acceptable move.\n");
@@ -325,14 +683,14 @@ int UCTSearch::get_best_move(passflag_t passflag) {
                 (score < 0.0f && color == FastBoard::BLACK)) {
                 myprintf("Passing loses :-(\n");
                 // Find a valid non-pass move.
-                UCTNode * nopass = m_root->get_nopass_child(m_rootstate);
-                if (nopass != nullptr) {
+                auto nopass = m_root->get_nopass_child(m_rootstate);
+                if (nopass) {
                     myprintf("Avoiding pass because it loses.\n");
-                    bestmove = nopass->get_move();
-                    if (nopass->first_visit()) {
+                    bestmove = nopass.get_move();
+                    if (nopass.first_visit()) {
                         bestscore = 1.0f;
                     } else {
-                        bestscore = nopass->get_eval(color);
+                        bestscore = nopass.get_eval(color);
                     }
                 } else {
                     myprintf("No alternative to passing.\n");
@@ -375,7 +733,7 @@ std::string UCTSearch::get_pv(KoState & state, UCTNode& parent) {
         return std::string();
     }
 
-    auto& best_child = parent.get_best_root_child(state.get_to_move());
+    const auto best_child = parent.get_best_root_child(state.get_to_move());
     if (best_child.first_visit()) {
         return std::string();
     }
@@ -384,7 +742,7 @@ std::string UCTSearch::get_pv(KoState & state, UCTNode& parent) {
 
     state.play_move(best_move);
 
-    auto next = get_pv(state, best_child);
+    auto next = get_pv(state, *best_child.get_node());
     if (!next.empty()) {
         res.append(" ").append(next);
     }
@@ -414,13 +772,11 @@ bool UCTSearch::playout_or_visit_limit_reached() const {
 }
 
 void UCTWorker::operator()() {
+    auto pending = UCTSearch::pending_batches_t{};
     do {
-        auto currstate = std::make_unique<GameState>(m_rootstate);
-        auto result = m_search->play_simulation(*currstate, m_root);
-        if (result.valid()) {
-            m_search->increment_playouts();
-        }
+        m_search->run_simulations(m_rootstate, m_root, pending);
     } while(m_search->is_running() && !m_search->playout_or_visit_limit_reached());
+    m_search->finish_simulations(pending);
 }
 
 void UCTSearch::increment_playouts() {
@@ -447,7 +803,7 @@ int UCTSearch::think(int color, passflag_t passflag) {
     // play something legal and decent even in time trouble)
     float root_eval;
     if (!m_root->has_children()) {
-        m_root->create_children(m_nodes, m_rootstate, root_eval);
+        m_root->create_children(m_nodes, *m_arena, m_rootstate, root_eval);
     } else {
         root_eval = m_root->get_eval(color);
     }
@@ -455,26 +811,25 @@ int UCTSearch::think(int color, passflag_t passflag) {
     if (cfg_noise) {
         m_root->dirichlet_noise(0.25f, 0.03f);
     }
+    m_root->create_child_nodes(*m_arena, m_rootstate);
 
     myprintf("NN eval=%f\n",
              (color == FastBoard::BLACK ? root_eval : 1.0f - root_eval));
 
     m_run = true;
     int cpus = cfg_num_threads;
+    ThreadGroup eval_tg(thread_pool);
+    start_evaluators(eval_tg);
     ThreadGroup tg(thread_pool);
     for (int i = 1; i < cpus; i++) {
-        tg.add_task(UCTWorker(m_rootstate, this, m_root.get()));
+        tg.add_task(UCTWorker(m_rootstate, this, m_root));
     }
 
     bool keeprunning = true;
     int last_update = 0;
+    auto pending = pending_batches_t{};
     do {
-        auto currstate = std::make_unique<GameState>(m_rootstate);
-
-        auto result = play_simulation(*currstate, m_root.get());
-        if (result.valid()) {
-            increment_playouts();
-        }
+        run_simulations(m_rootstate, m_root, pending);
 
         Time elapsed;
         int elapsed_centis = Time::timediff_centis(start, elapsed);
@@ -492,7 +847,9 @@ int UCTSearch::think(int color, passflag_t passflag) {
 
     // stop the search
     m_run = false;
+    finish_simulations(pending);
     tg.wait_all();
+    stop_evaluators(eval_tg);
     m_rootstate.stop_clock(color);
     if (!m_root->has_children()) {
         return FastBoard::PASS;
@@ -525,21 +882,23 @@ void UCTSearch::ponder() {
 
     m_run = true;
     int cpus = cfg_num_threads;
+    ThreadGroup eval_tg(thread_pool);
+    start_evaluators(eval_tg);
     ThreadGroup tg(thread_pool);
     for (int i = 1; i < cpus; i++) {
-        tg.add_task(UCTWorker(m_rootstate, this, m_root.get()));
+        tg.add_task(UCTWorker(m_rootstate, this, m_root));
     }
+    auto pending = pending_batches_t{};
     do {
-        auto currstate = std::make_unique<GameState>(m_rootstate);
-        auto result = play_simulation(*currstate, m_root.get());
-        if (result.valid()) {
-            increment_playouts();
-        }
+        run_simulations(m_rootstate, m_root, pending);
     } while(!Utils::input_pending() && is_running());
 
     // stop the search
     m_run = false;
+    finish_simulations(pending);
     tg.wait_all();
+    stop_evaluators(eval_tg);
+    m_root->create_child_nodes(*m_arena, m_rootstate);
     // display search info
     myprintf("\n");
     dump_stats(m_rootstate, *m_root);
@@ -547,6 +906,79 @@ void UCTSearch::ponder() {
     myprintf("\n%d visits, %d nodes\n\n", m_root->get_visits(), m_nodes.load());
 }
 
+void UCTSearch::tree_benchmark(const GameState& state,
+                               int max_threads, int playouts) {
+    // Every leaf gets the same made up policy and a random value. The
+    // priors fall off geometrically in a random move order, about as
+    // peaked as a real network's, so that the tree grows about as wide.
+    // No moves are played, the descents only exercise the tree.
+    auto moves = std::vector<int>{};
+    const auto boardsize = state.board.get_boardsize();
+    for (auto y = 0; y < boardsize; y++) {
+        for (auto x = 0; x < boardsize; x++) {
+            moves.emplace_back(state.board.get_vertex(x, y));
+        }
+    }
+    moves.emplace_back(FastBoard::PASS);
+    std::shuffle(begin(moves), end(moves), Random::get_Rng());
+    auto netresult = Network::Netresult{};
+    auto prior = 0.3f;
+    for (const auto move : moves) {
+        netresult.first.emplace_back(prior, move);
+        prior *= 0.7f;
+    }
+    netresult.second = 0.5f;
+
+    for (auto threads = 1; threads <= max_threads; threads *= 2) {
+        TreeArena arena;
+        std::atomic<int> nodes{0};
+        const auto root =
+            new (NodeArena::get(arena.nodes.allocate(1))) UCTNode(0.5f);
+        const auto per_thread = std::max(1, playouts / threads);
+
+        Time start;
+        auto workers = std::vector<std::thread>{};
+        for (auto i = 0; i < threads; i++) {
+            workers.emplace_back([&] {
+                auto leafstate = state;
+                const auto hash = leafstate.board.get_hash();
+                auto leaf = PendingLeaf{};
+                for (auto playout = 0; playout < per_thread; playout++) {
+                    auto color = leafstate.get_to_move();
+                    auto node = root;
+                    leaf.path.clear();
+                    leaf.edges.clear();
+                    node->virtual_loss();
+                    leaf.path.emplace_back(node);
+                    while (node->has_children()) {
+                        const auto next = node->uct_select_child(color);
+                        leaf.edges.emplace_back(next);
+                        node = node->get_child_node(next, arena, hash);
+                        node->virtual_loss();
+                        leaf.path.emplace_back(node);
+                        color = (color == FastBoard::BLACK ?
+                                 FastBoard::WHITE : FastBoard::BLACK);
+                    }
+                    if (node->acquire_expansion(leafstate)) {
+                        node->expand(nodes, arena, leafstate, netresult);
+                    }
+                    const auto eval = Random::get_Rng().randflt();
+                    backup(leaf, SearchResult::from_eval(eval));
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        Time end;
+
+        const auto elapsed = Time::timediff_seconds(start, end);
+        const auto total = per_thread * threads;
+        myprintf("%2d threads: %7d playouts in %5.2f seconds -> %d p/s\n",
+                 threads, total, elapsed, int(total / elapsed));
+    }
+}
+
 void UCTSearch::set_playout_limit(int playouts) {
     static_assert(std::is_convertible<decltype(playouts),
                                       decltype(m_maxplayouts)>::value,
@@ -20,13 +20,20 @@
 #define UCTSEARCH_H_INCLUDED
 
 #include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <tuple>
+#include <vector>
 
 #include "FastBoard.h"
 #include "GameState.h"
 #include "KoState.h"
+#include "LockFreeQueue.h"
+#include "Network.h"
+#include "ThreadPool.h"
 #include "UCTNode.h"
 
 
@@ -67,15 +74,21 @@ public:
     static constexpr passflag_t NORESIGN = 1 << 1;
 
     /*
-        Maximum size of the tree in memory. Nodes are about
-        48 bytes, so limit to ~1.2G on 32-bits and about 5.5G
-        on 64-bits.
+        Maximum size of the tree in memory, counted in edges. Edges
+        are 12 bytes, and only the visited ones get a node of 32
+        bytes, so limit to ~1G on 32-bits and about 4G on 64-bits.
     */
     static constexpr auto MAX_TREE_SIZE =
-        (sizeof(void*) == 4 ? 25'000'000 : 100'000'000);
+        (sizeof(void*) == 4 ? 75'000'000 : 350'000'000);
 
     UCTSearch(GameState& g);
+    ~UCTSearch();
     int think(int color, passflag_t passflag = NORMAL);
+    // Runs the tree search without the network, from 1 up to
+    // max_threads threads, to see how the tree code scales.
+    static void tree_benchmark(const GameState& state,
+                               int max_threads = 64,
+                               int playouts = 100000);
     void set_playout_limit(int playouts);
     void set_visit_limit(int visits);
     void ponder();
@@ -84,23 +97,88 @@ public:
     void increment_playouts();
     SearchResult play_simulation(GameState& currstate, UCTNode* const node);
 
+    // A simulation waiting for the evaluation of its last node. The
+    // nodes on the path keep their virtual loss until then.
+    struct PendingLeaf {
+        std::unique_ptr<GameState> state;
+        std::vector<UCTNode*> path;
+        // The moves between the nodes of the path
+        std::vector<UCTEdge> edges;
+        // Create the children, or only use the eval if the tree is full.
+        bool expand{false};
+    };
+
+    using leaf_ptr_t = std::unique_ptr<PendingLeaf>;
+
+    // The simulation is suspended here while the network works on the
+    // leaves, and resumes with their expansion and backup.
+    struct PendingBatch {
+        std::vector<leaf_ptr_t> leaves;
+        std::unique_ptr<Network::BatchEval> eval;
+    };
+
+    // Batches of simulations started by one search thread that wait
+    // for the evaluation of their leaves, oldest first.
+    using pending_batches_t = std::deque<std::unique_ptr<PendingBatch>>;
+
+    // One simulation, or with --leaf-batch a batch of them whose leaves
+    // are evaluated together. With --batches-in-flight, the thread goes
+    // on walking the tree for the next batches before it backs up the
+    // earlier ones. With --eval-threads, only the walk down the tree,
+    // the evaluator threads do the rest.
+    void run_simulations(GameState& rootstate, UCTNode* const root,
+                         pending_batches_t& pending);
+    // Backs up everything still in flight, before the thread stops.
+    void finish_simulations(pending_batches_t& pending);
+
 private:
+    UCTEdge play_child(UCTNode* const node, GameState& currstate);
+    bool select_leaf(UCTNode* const root, PendingLeaf& leaf,
+                     SearchResult& result);
+    void play_batch(GameState& rootstate, UCTNode* const root,
+                    const size_t batch_size, pending_batches_t& pending);
+    void finish_batch(pending_batches_t& pending);
+    void evaluate_leaves(std::vector<leaf_ptr_t>& leaves);
+    void resume_leaves(std::vector<leaf_ptr_t>& leaves,
+                       const std::vector<Network::Netresult>& netresults);
+    static void backup(const PendingLeaf& leaf, const SearchResult& result);
+
+    void queue_simulation(GameState& rootstate, UCTNode* const root);
+    void evaluator();
+    void start_evaluators(Utils::ThreadGroup& tg);
+    void stop_evaluators(Utils::ThreadGroup& tg);
     void dump_stats(KoState& state, UCTNode& parent);
     std::string get_pv(KoState& state, UCTNode& parent);
     void dump_analysis(int playouts);
     bool should_resign(passflag_t passflag, float bestscore);
     int get_best_move(passflag_t passflag);
     void update_root();
+    size_t count_nodes() const;
+    UCTNode* create_root();
     bool advance_to_new_rootstate();
 
     GameState & m_rootstate;
     std::unique_ptr<GameState> m_last_rootstate;
-    std::unique_ptr<UCTNode> m_root;
+    // Nodes of the tree below m_root, and garbage from earlier moves
+    std::unique_ptr<TreeArena> m_arena;
+    UCTNode* m_root{nullptr};
     std::atomic<int> m_nodes{0};
     std::atomic<int> m_playouts{0};
     std::atomic<bool> m_run{false};
     int m_maxplayouts;
     int m_maxvisits;
+
+    // Leaves the search threads queued for the evaluator threads
+    std::unique_ptr<LockFreeQueue<leaf_ptr_t>> m_leaf_queue;
+    std::atomic<int> m_pending_leaves{0};
+    int m_max_pending_leaves{0};
+    // Evaluators and search threads only sleep on these when there's
+    // nothing to do. m_evaluating is guarded by the mutex.
+    std::mutex m_pipeline_mutex;
+    std::condition_variable m_evaluator_cv;
+    std::condition_variable m_walker_cv;
+    std::atomic<int> m_idle_evaluators{0};
+    bool m_evaluating{false};
 };
 
 class UCTWorker {
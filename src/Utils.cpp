@@ -26,7 +26,14 @@
 #ifdef _WIN32
 #include <windows.h>
 #else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
 #include <sys/select.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 #endif
 
 #include "GTP.h"
@@ -75,6 +82,19 @@ bool Utils::input_pending(void) {
 #endif
 }
 
+void Utils::lower_thread_priority() {
+#ifdef _WIN32
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#elif defined(__linux__)
+    // Every thread has its own nice value on Linux.
+    setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19);
+#else
+    auto param = sched_param{};
+    param.sched_priority = sched_get_priority_min(SCHED_OTHER);
+    pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+#endif
+}
+
 static std::mutex IOmutex;
 
 void Utils::myprintf(const char *fmt, ...) {
@@ -144,3 +164,67 @@ size_t Utils::ceilMultiple(size_t a, size_t b) {
     auto ret = a + (b - a % b);
     return ret;
 }
+
+std::uint16_t Utils::float_to_half(const float f) {
+    auto bits = std::uint32_t{};
+    std::memcpy(&bits, &f, sizeof(bits));
+    const auto sign = std::uint16_t((bits >> 16) & 0x8000);
+    const auto magnitude = bits & 0x7fffffff;
+
+    if (magnitude >= 0x7f800000) {
+        // Infinity, or a quiet NaN
+        return sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 : 0);
+    }
+    if (magnitude >= 0x477ff000) {
+        // Rounds to 65520 or more, out of range
+        return sign | 0x7c00;
+    }
+    if (magnitude < 0x38800000) {
+        // Subnormal half, in units of 2^-24
+        if (magnitude <= 0x33000000) {
+            return sign;
+        }
+        const auto shift = 126 - (magnitude >> 23);
+        const auto mant = (magnitude & 0x7fffff) | 0x800000;
+        auto h = mant >> shift;
+        const auto rem = mant & ((1u << shift) - 1);
+        const auto halfway = 1u << (shift - 1);
+        if (rem > halfway || (rem == halfway && (h & 1))) {
+            h++;
+        }
+        return sign | std::uint16_t(h);
+    }
+    // Rebias the exponent, a carry out of the mantissa bumps it
+    auto h = (magnitude - 0x38000000) >> 13;
+    const auto rem = magnitude & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) {
+        h++;
+    }
+    return sign | std::uint16_t(h);
+}
+
+float Utils::half_to_float(const std::uint16_t h) {
+    const auto sign = std::uint32_t(h & 0x8000) << 16;
+    auto exponent = std::uint32_t(h >> 10) & 0x1f;
+    auto mant = std::uint32_t(h) & 0x3ff;
+
+    auto bits = std::uint32_t{};
+    if (exponent == 0x1f) {
+        bits = sign | 0x7f800000 | (mant << 13);
+    } else if (exponent != 0) {
+        bits = sign | ((exponent + 112) << 23) | (mant << 13);
+    } else if (mant == 0) {
+        bits = sign;
+    } else {
+        // Subnormal half, normalize
+        exponent = 113;
+        while (!(mant & 0x400)) {
+            mant <<= 1;
+            exponent--;
+        }
+        bits = sign | (exponent << 23) | ((mant & 0x3ff) << 13);
+    }
+    auto f = 0.0f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
@@ -21,7 +21,11 @@
 
 #include "config.h"
 
+#include <algorithm>
 #include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <limits>
 #include <string>
 
@@ -35,6 +39,9 @@ namespace Utils {
     void gtp_fail_printf(int id, const char *fmt, ...);
     void log_input(const std::string& input);
     bool input_pending();
+    // For threads doing housekeeping that the search shouldn't wait
+    // for. Best effort, fails silently.
+    void lower_thread_priority();
 
     template<class T>
     void atomic_add(std::atomic<T> &f, T d) {
@@ -52,6 +59,54 @@ namespace Utils {
     }
 
     size_t ceilMultiple(size_t a, size_t b);
+
+    // IEEE 754 half precision conversions, rounding to nearest even.
+    std::uint16_t float_to_half(const float f);
+    float half_to_float(const std::uint16_t h);
+
+    // half_to_float for everything but infinities and NaNs. Branch
+    // free, so loops over arrays of halves vectorize.
+    inline float finite_half_to_float(const std::uint16_t h) {
+        // Normal halves only need the wider exponent of a float,
+        // subnormals are their mantissa times 2^-24.
+        const auto normal_bits =
+            ((std::uint32_t(h) & 0x7fff) << 13) + (std::uint32_t(112) << 23);
+        auto normal = 0.0f;
+        std::memcpy(&normal, &normal_bits, sizeof(normal));
+        const auto subnormal = float(h & 0x3ff) * 5.9604644775390625e-8f;
+        const auto magnitude = (h & 0x7c00) ? normal : subnormal;
+        auto bits = std::uint32_t{};
+        std::memcpy(&bits, &magnitude, sizeof(bits));
+        bits |= std::uint32_t(h & 0x8000) << 16;
+        auto f = 0.0f;
+        std::memcpy(&f, &bits, sizeof(f));
+        return f;
+    }
+
+    // Polynomial approximation of exp(x), within a few ulp over the
+    // float range. Branch free, so loops calling it vectorize.
+    inline float fast_exp(float x) {
+        x = std::min(std::max(x, -87.3f), 88.3f);
+        // exp(x) = 2^n * exp(r), |r| <= ln(2) / 2
+        const auto n = std::floor(x * 1.44269504088896341f + 0.5f);
+        const auto r = x - n * 0.693359375f + n * 2.12194440e-4f;
+        auto p = 1.9875691500e-4f;
+        p = p * r + 1.3981999507e-3f;
+        p = p * r + 8.3334519073e-3f;
+        p = p * r + 4.1665795894e-2f;
+        p = p * r + 1.6666665459e-1f;
+        p = p * r + 5.0000001201e-1f;
+        p = p * r * r + r + 1.0f;
+        // Scale by 2^n through the exponent bits
+        const auto bits = std::int32_t(n + 127.0f) << 23;
+        auto scale = 0.0f;
+        std::memcpy(&scale, &bits, sizeof(scale));
+        return p * scale;
+    }
+
+    inline float fast_tanh(const float x) {
+        return 1.0f - 2.0f / (fast_exp(2.0f * x) + 1.0f);
+    }
 }
 
 #endif
@@ -83,9 +83,9 @@
 
 using net_t = float;
 
-#if defined(USE_BLAS) && defined(USE_OPENCL) && !defined(USE_HALF)
-// If both BLAS and OpenCL are fully usable, then check the OpenCL
-// results against BLAS with some probability.
+#if defined(USE_BLAS) && defined(USE_OPENCL)
+// If both BLAS and OpenCL are fully usable, then check single precision
+// OpenCL results against BLAS with some probability.
 #define USE_OPENCL_SELFCHECK
 #define SELFCHECK_PROBABILITY 2000
 #endif
@@ -0,0 +1,105 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "Arena.h"
+
+namespace {
+    // Its own type, so that no other test shares the chunks.
+    struct Slot {
+        std::uint64_t value;
+    };
+    using SlotArena = Arena<Slot>;
+    constexpr std::uint32_t NONE = SlotArena::NONE;
+}
+
+TEST(ArenaTest, NeverNone) {
+    SlotArena arena;
+    for (auto i = 0; i < 3 * int{SlotArena::CHUNK_SIZE}; i++) {
+        EXPECT_NE(arena.allocate(1), NONE);
+    }
+    EXPECT_NE(arena.allocate(SlotArena::CHUNK_SIZE), NONE);
+    EXPECT_EQ(arena.size(), size_t{4} * SlotArena::CHUNK_SIZE);
+}
+
+TEST(ArenaTest, IndexRoundTrip) {
+    SlotArena arena;
+    auto runs = std::vector<std::pair<std::uint32_t, std::uint32_t>>{};
+    // Runs that don't fit in what is left of a chunk start a new one.
+    for (auto count : {1u, 7u, 1000u, SlotArena::CHUNK_SIZE - 5, 300u}) {
+        const auto index = arena.allocate(count);
+        for (auto i = 0u; i < count; i++) {
+            SlotArena::get(index + i)->value = index + i;
+        }
+        runs.emplace_back(index, count);
+    }
+    // Runs are consecutive and don't overlap.
+    for (const auto& run : runs) {
+        const auto first = run.first >> SlotArena::CHUNK_BITS;
+        const auto last = (run.first + run.second - 1) >> SlotArena::CHUNK_BITS;
+        EXPECT_EQ(first, last);
+        for (auto i = 0u; i < run.second; i++) {
+            EXPECT_EQ(SlotArena::get(run.first + i)->value, run.first + i);
+        }
+    }
+}
+
+TEST(ArenaTest, ReuseAfterRelease) {
+    SlotArena arena;
+    const auto index = arena.allocate(1);
+    arena.release();
+    EXPECT_EQ(arena.size(), size_t{0});
+
+    // The freed chunk is handed out again, and not continued where
+    // the released arena stopped.
+    const auto again = arena.allocate(1);
+    EXPECT_EQ(again >> SlotArena::CHUNK_BITS, index >> SlotArena::CHUNK_BITS);
+    EXPECT_EQ(again & (SlotArena::CHUNK_SIZE - 1), 0u);
+    SlotArena::get(again)->value = 42;
+    EXPECT_EQ(SlotArena::get(again)->value, 42u);
+}
+
+TEST(ArenaTest, ThreadsGetDistinctSlots) {
+    constexpr auto threads = 4;
+    constexpr auto per_thread = 50000;
+    SlotArena arena;
+    auto indices = std::vector<std::vector<std::uint32_t>>(threads);
+    auto workers = std::vector<std::thread>{};
+    for (auto t = 0; t < threads; t++) {
+        workers.emplace_back([&arena, &indices, t]() {
+            for (auto i = 0; i < per_thread; i++) {
+                const auto index = arena.allocate(1);
+                SlotArena::get(index)->value = t;
+                indices[t].emplace_back(index);
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    for (auto t = 0; t < threads; t++) {
+        for (const auto index : indices[t]) {
+            EXPECT_EQ(SlotArena::get(index)->value, std::uint64_t(t));
+        }
+    }
+    EXPECT_EQ(arena.size(), size_t{threads * per_thread});
+}
@@ -0,0 +1,118 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "LockFreeQueue.h"
+
+TEST(LockFreeQueueTest, FifoOrder) {
+    LockFreeQueue<int> queue(8);
+    for (auto i = 0; i < 8; i++) {
+        EXPECT_TRUE(queue.push(int{i}));
+    }
+    for (auto i = 0; i < 8; i++) {
+        auto value = -1;
+        EXPECT_TRUE(queue.pop(value));
+        EXPECT_EQ(value, i);
+    }
+}
+
+TEST(LockFreeQueueTest, FullAndEmpty) {
+    // Capacity is rounded up to 8
+    LockFreeQueue<int> queue(5);
+    auto value = -1;
+    EXPECT_TRUE(queue.empty());
+    EXPECT_FALSE(queue.pop(value));
+
+    for (auto i = 0; i < 8; i++) {
+        EXPECT_TRUE(queue.push(int{i}));
+    }
+    EXPECT_FALSE(queue.empty());
+    EXPECT_FALSE(queue.push(8));
+
+    // A pop makes room for one more
+    EXPECT_TRUE(queue.pop(value));
+    EXPECT_EQ(value, 0);
+    EXPECT_TRUE(queue.push(8));
+    EXPECT_FALSE(queue.push(9));
+
+    for (auto i = 1; i <= 8; i++) {
+        EXPECT_TRUE(queue.pop(value));
+        EXPECT_EQ(value, i);
+    }
+    EXPECT_TRUE(queue.empty());
+    EXPECT_FALSE(queue.pop(value));
+}
+
+TEST(LockFreeQueueTest, ManyProducersAndConsumers) {
+    constexpr auto threads = 4;
+    constexpr auto per_producer = 20000;
+    LockFreeQueue<int> queue(64);
+
+    auto producers = std::vector<std::thread>{};
+    for (auto p = 0; p < threads; p++) {
+        producers.emplace_back([&queue, p]() {
+            for (auto i = 0; i < per_producer; i++) {
+                while (!queue.push(p * per_producer + i)) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    // Every value is popped exactly once.
+    auto seen = std::vector<std::vector<int>>(threads);
+    std::atomic<int> popped{0};
+    auto consumers = std::vector<std::thread>{};
+    for (auto c = 0; c < threads; c++) {
+        consumers.emplace_back([&queue, &seen, &popped, c]() {
+            while (popped < threads * per_producer) {
+                auto value = -1;
+                if (queue.pop(value)) {
+                    seen[c].emplace_back(value);
+                    popped++;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (auto& thread : producers) {
+        thread.join();
+    }
+    for (auto& thread : consumers) {
+        thread.join();
+    }
+
+    auto count = std::vector<int>(threads * per_producer);
+    for (const auto& values : seen) {
+        // Values of one producer come out in the order it pushed them.
+        auto last = std::vector<int>(threads, -1);
+        for (const auto value : values) {
+            count[value]++;
+            EXPECT_GT(value, last[value / per_producer]);
+            last[value / per_producer] = value;
+        }
+    }
+    for (auto i = 0; i < threads * per_producer; i++) {
+        EXPECT_EQ(count[i], 1) << "value " << i;
+    }
+    EXPECT_TRUE(queue.empty());
+}
@@ -0,0 +1,64 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2018 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <gtest/gtest.h>
+
+#include <cstdint>
+
+#include "TranspositionTable.h"
+
+namespace {
+    constexpr std::uint32_t NONE = TranspositionTable::NONE;
+}
+
+TEST(TranspositionTableTest, FirstInsertWins) {
+    TranspositionTable table;
+    const auto hash = std::uint64_t{0x0123456789ABCDEF};
+    EXPECT_EQ(table.find(hash), NONE);
+
+    EXPECT_EQ(table.insert(hash, 5), 5u);
+    // Another thread reaching the position later gets the first node.
+    EXPECT_EQ(table.insert(hash, 9), 5u);
+    EXPECT_EQ(table.find(hash), 5u);
+
+    // Only the same hash matches.
+    EXPECT_EQ(table.find(hash + 1), NONE);
+    EXPECT_EQ(table.insert(hash + 1, 9), 9u);
+}
+
+TEST(TranspositionTableTest, RemapErasesNone) {
+    TranspositionTable table;
+    // Spread over the shards
+    for (auto i = std::uint64_t{1}; i <= 1000; i++) {
+        table.insert(i * 0x9E3779B97F4A7C15, std::uint32_t(i));
+    }
+
+    // Odd nodes were moved, even ones discarded.
+    table.remap([](std::uint32_t node) {
+        return node % 2 ? node + 10000 : NONE;
+    });
+    for (auto i = std::uint64_t{1}; i <= 1000; i++) {
+        const auto hash = i * 0x9E3779B97F4A7C15;
+        if (i % 2) {
+            EXPECT_EQ(table.find(hash), std::uint32_t(i + 10000));
+        } else {
+            EXPECT_EQ(table.find(hash), NONE);
+            // The entry is gone, so the position can get a new node.
+            EXPECT_EQ(table.insert(hash, 7), 7u);
+        }
+    }
+}
@@ -17,6 +17,9 @@
 */
 #include <gtest/gtest.h>
 
+#include <cmath>
+#include <cstring>
+
 #include "Utils.h"
 
 using namespace Utils;
@@ -43,3 +46,52 @@ TEST(UtilsTest, CeilMultiple) {
     EXPECT_EQ(ceilMultiple(23, 5), (size_t)25);
     EXPECT_EQ(ceilMultiple(99, 100), (size_t)100);
 }
+
+TEST(UtilsTest, FastExp) {
+    for (auto x = -80.0f; x < 80.0f; x += 0.37f) {
+        EXPECT_NEAR(fast_exp(x) / std::exp(x), 1.0f, 1e-6f) << "x = " << x;
+    }
+    EXPECT_EQ(fast_exp(0.0f), 1.0f);
+    // Saturates instead of overflowing
+    EXPECT_GT(fast_exp(-1000.0f), 0.0f);
+    EXPECT_TRUE(std::isfinite(fast_exp(1000.0f)));
+}
+
+TEST(UtilsTest, FastTanh) {
+    for (auto x = -20.0f; x < 20.0f; x += 0.013f) {
+        EXPECT_NEAR(fast_tanh(x), std::tanh(x), 1e-6f) << "x = " << x;
+    }
+}
+
+TEST(UtilsTest, HalfConversion) {
+    EXPECT_EQ(float_to_half(0.0f), 0x0000);
+    EXPECT_EQ(float_to_half(-0.0f), 0x8000);
+    EXPECT_EQ(float_to_half(1.0f), 0x3c00);
+    EXPECT_EQ(float_to_half(-2.0f), 0xc000);
+    EXPECT_EQ(float_to_half(65504.0f), 0x7bff);
+    EXPECT_EQ(float_to_half(1e6f), 0x7c00);
+    EXPECT_EQ(float_to_half(std::ldexp(1.0f, -24)), 0x0001);
+    EXPECT_EQ(float_to_half(std::ldexp(1.0f, -26)), 0x0000);
+    // Ties round to even
+    EXPECT_EQ(float_to_half(1.0f + std::ldexp(1.0f, -11)), 0x3c00);
+    EXPECT_EQ(float_to_half(1.0f + 3.0f * std::ldexp(1.0f, -11)), 0x3c02);
+
+    // Every finite half survives a round trip
+    for (auto h = 0; h < 0x10000; h++) {
+        if ((h & 0x7c00) == 0x7c00) {
+            continue;
+        }
+        EXPECT_EQ(float_to_half(half_to_float(std::uint16_t(h))), h);
+    }
+    EXPECT_EQ(half_to_float(0x0001), std::ldexp(1.0f, -24));
+    EXPECT_EQ(half_to_float(0x3555), 0.333251953125f);
+
+    for (auto h = 0; h < 0x10000; h++) {
+        if ((h & 0x7c00) == 0x7c00) {
+            continue;
+        }
+        const auto f = half_to_float(std::uint16_t(h));
+        const auto g = finite_half_to_float(std::uint16_t(h));
+        EXPECT_EQ(std::memcmp(&f, &g, sizeof(f)), 0) << "h = " << h;
+    }
+}